@@ -0,0 +1,304 @@
+#include "../include/base.h"
+#include "../include/header.h"
+#include "../include/rb_tree.h"
+#include "../include/rand.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+    Micro benchmarks for the free tree: every operation is run on trees of
+    10 to 10^max nodes, for several size distributions, and reported per op
+    from hardware counters (perf_event_open). When counters are not
+    available cycles come from the TSC and the rest is reported as n/a.
+
+    usage: rb_tree_bench [max exponent, default 6, up to 7]
+ */
+
+#define MAX_EXPONENT 7
+#define TARGET_OPS 1000000 /* small trees are rebuilt until this many ops are measured */
+#define STRIDE 128 /* a cache line aligned slot per node */
+#define LINE_OFFSETS 4 /* headers sit 8 bytes before 16 aligned data: 8, 24, 40 or 56 into a line */
+#define SEED 0x853c49e6748fea9bULL
+
+typedef enum Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    BRANCH_MISSES,
+    N_COUNTERS
+} Counter;
+
+typedef enum Distribution {
+    SMALL,   /* 16 - 1024, uniform */
+    WIDE,    /* 16 - 1M, log uniform */
+    CLASSES, /* 8 sizes, lots of duplicates */
+    N_DISTRIBUTIONS
+} Distribution;
+
+typedef struct Counters {
+    u64 values[N_COUNTERS];
+    u64 ops;
+} counters_t;
+
+static const char* distribution_names[N_DISTRIBUTIONS] = { "small", "wide", "classes" };
+static const u64 perf_configs[N_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int perf_fds[N_COUNTERS] = { -1, -1, -1, -1 };
+static bool has_perf = false;
+static u64 tsc_start = 0;
+static pcg32_random_t rng = PCG32_INITIALIZER;
+
+static u8* arena = NULL;
+static node_t** nodes = NULL;
+static u64* targets = NULL;
+
+/* helpers */
+static void open_counters ( void );
+static void start_counters ( void );
+static void stop_counters ( counters_t* counters );
+static u64 read_tsc ( void );
+static u64 draw_size ( Distribution distribution );
+static node_t* node_at ( u64 i );
+static void set_node ( node_t* node, u64 size );
+static void shuffle ( node_t** array, u64 n );
+static int compare_sizes ( const void* a, const void* b );
+static void build_tree ( node_t** root, u64 n );
+static void bench_insert ( u64 n, Distribution distribution, bool sorted );
+static void bench_search ( u64 n, Distribution distribution );
+static void bench_delete ( u64 n, Distribution distribution, bool minimum_first );
+static void bench_merge ( u64 n );
+static void report ( const char* op, const char* distribution, u64 n, counters_t* counters );
+
+int main ( int argc, char** argv ) {
+    u64 max_exponent = argc > 1 ? strtoull(argv[1], NULL, 10) : 6;
+    if ( max_exponent < 1 || max_exponent > MAX_EXPONENT ) {
+        fprintf(stderr, "max exponent must be between 1 and %d\n", MAX_EXPONENT);
+        return 1;
+    }
+
+    u64 max_nodes = 1;
+    for ( u64 i = 0; i < max_exponent; i++ ) max_nodes *= 10;
+
+    arena = mmap(NULL, max_nodes * STRIDE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    nodes = malloc(max_nodes * sizeof(node_t*));
+    targets = malloc(max_nodes * sizeof(u64));
+    if ( arena == MAP_FAILED || !nodes || !targets ) {
+        fprintf(stderr, "not enough memory for %llu nodes\n", max_nodes);
+        return 1;
+    }
+
+    open_counters();
+    printf("counters: %s\n", has_perf ? "perf_event_open" : "TSC only (perf_event_open unavailable)");
+    printf("%-14s %-8s %9s %10s %10s %8s %12s %12s\n",
+           "op", "dist", "nodes", "cycles/op", "instr/op", "IPC", "cmiss/op", "bmiss/op");
+
+    for ( u64 n = 10; n <= max_nodes; n *= 10 ) {
+        for ( Distribution d = 0; d < N_DISTRIBUTIONS; d++ ) {
+            bench_insert(n, d, false);
+            bench_search(n, d);
+            bench_delete(n, d, false);
+        }
+        bench_insert(n, SMALL, true);  /* ascending keys rotate on almost every insert */
+        bench_delete(n, SMALL, true);  /* always removing the minimum drives fix_deletion */
+        bench_merge(n);
+    }
+
+    return 0;
+}
+
+static void bench_insert ( u64 n, Distribution distribution, bool sorted ) {
+    counters_t counters = { 0 };
+    u64 reps = n < TARGET_OPS ? TARGET_OPS / n : 1;
+
+    while ( reps-- ) {
+        for ( u64 i = 0; i < n; i++ ) set_node(nodes[i] = node_at(i), draw_size(distribution));
+        if ( sorted ) qsort(nodes, n, sizeof(node_t*), compare_sizes);
+        else shuffle(nodes, n);
+
+        node_t* root = __sentinel;
+        start_counters();
+        for ( u64 i = 0; i < n; i++ ) insert(&root, nodes[i]);
+        stop_counters(&counters);
+        counters.ops += n;
+    }
+    report(sorted ? "insert-sorted" : "insert", distribution_names[distribution], n, &counters);
+}
+
+static void bench_search ( u64 n, Distribution distribution ) {
+    counters_t counters = { 0 };
+    u64 reps = n < TARGET_OPS ? TARGET_OPS / n : 1;
+    node_t* root = __sentinel;
+
+    for ( u64 i = 0; i < n; i++ ) set_node(nodes[i] = node_at(i), draw_size(distribution));
+    shuffle(nodes, n);
+    build_tree(&root, n);
+    for ( u64 i = 0; i < n; i++ ) targets[i] = draw_size(distribution);
+
+    u64 found = 0; /* keeps the loop from being optimized away */
+    while ( reps-- ) {
+        start_counters();
+        for ( u64 i = 0; i < n; i++ ) found += search(root, targets[i]) != __sentinel;
+        stop_counters(&counters);
+        counters.ops += n;
+    }
+    if ( found == (u64)-1 ) puts("");
+    report("search", distribution_names[distribution], n, &counters);
+}
+
+static void bench_delete ( u64 n, Distribution distribution, bool minimum_first ) {
+    counters_t counters = { 0 };
+    u64 reps = n < TARGET_OPS ? TARGET_OPS / n : 1;
+
+    while ( reps-- ) {
+        node_t* root = __sentinel;
+        for ( u64 i = 0; i < n; i++ ) set_node(nodes[i] = node_at(i), draw_size(distribution));
+        shuffle(nodes, n);
+        build_tree(&root, n);
+        if ( minimum_first ) qsort(nodes, n, sizeof(node_t*), compare_sizes);
+        else shuffle(nodes, n);
+
+        start_counters();
+        for ( u64 i = 0; i < n; i++ ) delete(&root, nodes[i]);
+        stop_counters(&counters);
+        counters.ops += n;
+    }
+    report(minimum_first ? "delete-min" : "delete", distribution_names[distribution], n, &counters);
+}
+
+static void bench_merge ( u64 n ) { /* merges pairs of contiguous free blocks laid out like a chunk */
+    counters_t counters = { 0 };
+    u64 reps = n < TARGET_OPS ? TARGET_OPS / n : 1;
+    u64 block = sizeof(node_t) + sizeof(header_t); /* smallest block, footer included */
+    u64 pairs = n / 2 ? n / 2 : 1;
+
+    while ( reps-- ) {
+        u8* cursor = arena + sizeof(header_t);
+        for ( u64 i = 0; i < 2 * pairs; i++, cursor += block )
+            nodes[i] = init_node(cursor, block - 2 * sizeof(header_t), __red, __free);
+
+        start_counters();
+        for ( u64 i = 0; i < 2 * pairs; i += 2 ) merge_nodes(nodes[i], nodes[i + 1]);
+        stop_counters(&counters);
+        counters.ops += pairs;
+    }
+    report("merge_nodes", "-", n, &counters);
+}
+
+static void build_tree ( node_t** root, u64 n ) {
+    for ( u64 i = 0; i < n; i++ ) insert(root, nodes[i]);
+}
+
+static node_t* node_at ( u64 i ) { /* cycles through every line offset a heap node can have */
+    return (node_t *)(arena + i * STRIDE + sizeof(header_t) + 16 * (i % LINE_OFFSETS));
+}
+
+static void set_node ( node_t* node, u64 size ) { /* like init_node, but without touching a footer the slot cannot hold */
+    node->header = 0;
+    set_size(&node->header, size);
+    set_status(&node->header, __free);
+    set_parent(node, __sentinel);
+    set_left(node, __sentinel);
+    set_right(node, __sentinel);
+}
+
+static u64 draw_size ( Distribution distribution ) {
+    static const u64 classes[] = { 32, 48, 64, 128, 256, 512, 1024, 4096 };
+    switch ( distribution ) {
+        case SMALL: return 16 * (1 + pcg32_boundedrand_r(&rng, 64));
+        case WIDE: return ((u64) 16 << pcg32_boundedrand_r(&rng, 16)) + 16 * pcg32_boundedrand_r(&rng, 16);
+        case CLASSES: return classes[pcg32_boundedrand_r(&rng, sizeof(classes) / sizeof(classes[0]))];
+        default: return 16;
+    }
+}
+
+static void shuffle ( node_t** array, u64 n ) { /* Fisher-Yates */
+    for ( u64 i = n - 1; i > 0; i-- ) {
+        u64 j = pcg32_boundedrand_r(&rng, i + 1);
+        node_t* aux = array[i];
+        array[i] = array[j];
+        array[j] = aux;
+    }
+}
+
+static int compare_sizes ( const void* a, const void* b ) {
+    u64 size_a = get_size((*(node_t* const*)a)->header);
+    u64 size_b = get_size((*(node_t* const*)b)->header);
+    return (size_a > size_b) - (size_a < size_b);
+}
+
+static void open_counters ( void ) { /* one group led by cycles, user space only */
+    pcg32_srandom_r(&rng, SEED, 27u);
+
+    for ( Counter c = 0; c < N_COUNTERS; c++ ) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_configs[c];
+        attr.disabled = c == CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        perf_fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, c == CYCLES ? -1 : perf_fds[CYCLES], 0);
+        if ( perf_fds[c] < 0 ) {
+            for ( Counter o = 0; o < c; o++ ) close(perf_fds[o]);
+            return;
+        }
+    }
+    has_perf = true;
+}
+
+static void start_counters ( void ) {
+    if ( has_perf ) {
+        ioctl(perf_fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    else tsc_start = read_tsc();
+}
+
+static void stop_counters ( counters_t* counters ) {
+    if ( !has_perf ) {
+        counters->values[CYCLES] += read_tsc() - tsc_start;
+        return;
+    }
+
+    ioctl(perf_fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    u64 group[1 + N_COUNTERS] = { 0 }; /* nr, then one value per counter */
+    if ( read(perf_fds[CYCLES], group, sizeof(group)) != sizeof(group) ) return;
+    for ( Counter c = 0; c < N_COUNTERS; c++ ) counters->values[c] += group[1 + c];
+}
+
+static u64 read_tsc ( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec; /* nanoseconds stand in for cycles */
+#endif
+}
+
+static void report ( const char* op, const char* distribution, u64 n, counters_t* counters ) {
+    double ops = counters->ops ? (double)counters->ops : 1.0;
+    printf("%-14s %-8s %9llu %10.1f ", op, distribution, n, counters->values[CYCLES] / ops);
+    if ( has_perf ) {
+        double ipc = counters->values[CYCLES] ? (double)counters->values[INSTRUCTIONS] / counters->values[CYCLES] : 0.0;
+        printf("%10.1f %8.2f %12.3f %12.3f\n", counters->values[INSTRUCTIONS] / ops, ipc,
+               counters->values[CACHE_MISSES] / ops, counters->values[BRANCH_MISSES] / ops);
+    }
+    else printf("%10s %8s %12s %12s\n", "n/a", "n/a", "n/a", "n/a");
+    fflush(stdout);
+}
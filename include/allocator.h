@@ -3,9 +3,50 @@
 
 #include "base.h"
 
+typedef struct Stats {
+    u64 mapped_bytes;  /* bytes obtained from the OS */
+    u64 free_bytes;    /* bytes sitting in the free tree */
+    u64 free_blocks;   /* nodes in the free tree */
+    u64 largest_free;  /* biggest request served without asking the OS */
+} stats_t;
 
+typedef enum Hint { /* expected lifetime, every hint gets its own arena */
+    NO_HINT,
+    SHORT_LIVED,  /* request buffers, freed soon */
+    LONG_LIVED,   /* caches, outlive many requests */
+    IMMORTAL,     /* never freed */
+    N_HINTS
+} Hint;
+
+typedef enum InitFlags {
+    INIT_PREFAULT = 1,  /* fault every page in up front (MAP_POPULATE), purge() leaves them alone */
+    INIT_MLOCK = 2,     /* keep heap pages in RAM, growth included */
+    INIT_NO_GROW = 4    /* once the reserve is used up allocations fail instead of mapping more */
+} InitFlags;
+
+typedef enum Option { /* runtime tuning, also read from MYMALLOC_OPTIONS="key=value,...", values decimal or 0x hex with an optional k, m or g */
+    OPTION_MMAP_THRESHOLD,   /* mmap_threshold: requests this big get a mapping of their own, 0 never */
+    OPTION_CHUNK_SIZE,       /* chunk_size: smallest chunk asked to the OS */
+    OPTION_QUICK_MAX,        /* quick_max: biggest block kept in quick lists (up to 512), 0 disables them */
+    OPTION_QUICK_THRESHOLD,  /* quick_threshold: deferred blocks before a forced consolidation */
+    OPTION_PURGE_DECAY,      /* purge_decay: ms between automatic purges on free, -1 never */
+    OPTION_HUGE_PAGES,       /* huge_pages: 1 to ask for transparent huge pages on big chunks */
+    OPTION_ARENAS,           /* arenas: in use counting the default heap, later hints share the default heap */
+    N_OPTIONS
+} Option;
+
+extern bool allocator_init ( u64 reserve_bytes, u32 flags ); /* call before the first allocate */
+extern bool allocator_set_option ( Option key, i64 value );
+extern i64 allocator_get_option ( Option key );
+extern bool allocator_parse_options ( const char* options ); /* same syntax as MYMALLOC_OPTIONS */
 extern void* allocate ( u64 size );
 extern void* reallocate ( void* ptr, u64 size );
-extern void deallocate ( void* ptr ); 
+extern void deallocate ( void* ptr );
+extern void* allocate_hinted ( u64 size, Hint hint );
+extern void* allocate_at_least ( u64 size, u64* actual ); /* actual: the capacity really handed out */
+extern u64 usable_size ( void* ptr ); /* 0 for pointers this allocator does not own */
+
+extern void get_stats ( stats_t* stats );
+extern u64 purge ( void ); /* returns whole free pages to the OS */
 
 #endif
@@ -3,14 +3,28 @@
 
 #include "base.h"
 
+/*
+    |-  63  -|-  62 -|-  61 -|- 60 ... 57 -|- 56 ... 52 -|- 51 ... 48 -|- 47 ... 0 -|
+    | STATUS | COLOR | QUICK |   reserved  |     TAG     |   reserved  |    SIZE    |
+
+    QUICK marks an in-use block parked in a quick list, waiting to be coalesced.
+    TAG is the subsystem an in-use block is accounted to (see tags.h), 0 if none.
+    The arena a block belongs to and whether it has a mapping of its own are
+    not kept here: the page map (page_map.h) knows them from its address.
+ */
+
 typedef u64 header_t;
 
 extern bool get_color ( header_t header );
 extern bool get_status ( header_t header );
+extern bool get_quick ( header_t header );
+extern u8 get_tag ( header_t header );
 extern u64 get_size ( header_t header );
 
 extern void set_color ( header_t* header, bool color );
 extern void set_status ( header_t* header, bool status );
+extern void set_quick ( header_t* header, bool quick );
+extern void set_tag ( header_t* header, u8 tag );
 extern void set_size ( header_t* header, u64 size );   
 
 
@@ -18,5 +32,7 @@ extern void set_size ( header_t* header, u64 size );
 #define __black 0
 #define __free 1
 #define __in_use 0
+#define __max_arenas 16
+#define __max_tags 32
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "base.h"
+
+/*
+    Per-path latency histograms, compiled in with MYMALLOC_LATENCY (cmake
+    -DMYMALLOC_LATENCY=ON). Every path records its cycles (rdtsc) into a
+    per-thread log-linear histogram: exact below LATENCY_SUB_BUCKETS cycles,
+    then LATENCY_SUB_BUCKETS buckets per power of two. Paths nest, an
+    allocate that misses the quick lists also records a tree search, a tree
+    delete, a tree insert and maybe an mmap. The tree paths are timed inside
+    split_node and coalesce, so the shared heaps record them too.
+ */
+
+#define LATENCY_SUB_BITS 2
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef enum LatencyPath {
+    LATENCY_ALLOCATE,
+    LATENCY_DEALLOCATE,
+    LATENCY_REALLOCATE,
+    LATENCY_QUICK_HIT,    /* allocate served by a quick list */
+    LATENCY_TREE_SEARCH,
+    LATENCY_TREE_INSERT,  /* split remainders and coalesced blocks */
+    LATENCY_TREE_DELETE,  /* best fits and the neighbours a block merges with */
+    LATENCY_MMAP,         /* mmap and munmap, mlock and madvise included */
+    LATENCY_PURGE,
+    N_LATENCY_PATHS
+} LatencyPath;
+
+typedef struct LatencyStats {
+    u64 count;
+    u64 cycles;                     /* sum, for the mean */
+    u64 buckets[LATENCY_BUCKETS];
+} latency_stats_t;
+
+extern bool get_latency_stats ( LatencyPath path, latency_stats_t* stats ); /* false when compiled out */
+extern u64 latency_percentile ( const latency_stats_t* stats, double fraction ); /* upper bound, in cycles */
+extern u64 latency_bucket_floor ( u32 bucket );
+
+extern void record_latency ( LatencyPath path, u64 cycles ); /* for the allocator */
+
+#ifdef MYMALLOC_LATENCY
+#include <time.h>
+
+static inline u64 read_cycles ( void ) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec; /* nanoseconds stand in for cycles */
+#endif
+}
+
+#define LATENCY_START( start ) u64 start = read_cycles()
+#define LATENCY_STOP( path, start ) record_latency(path, read_cycles() - (start))
+#else
+#define LATENCY_START( start )
+#define LATENCY_STOP( path, start )
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include "base.h"
+
+/*
+    Global map from page number to the span (chunk or mapped block) holding
+    it, a three level radix tree over the 36 bit page number of a 48 bit
+    address:
+
+    |- 47 ... 36 -|- 35 ... 24 -|- 23 ... 12 -|- 11 ... 0 -|
+    |    ROOT     |     MID     |     LEAF    |   OFFSET   |
+
+    Lookups never lock: interior nodes are installed with a CAS and never
+    freed, leaf entries are single words. Writers are the threads mapping
+    and unmapping the spans, so an entry only changes under its owner.
+ */
+
+typedef struct Span {
+    void* start;  /* first byte of the mapping */
+    u8 arena;     /* heap its blocks belong to */
+    bool mapped;  /* a single block with a mapping of its own */
+} span_t;
+
+extern bool page_map_set ( void* start, u64 length, u8 arena, bool mapped );
+extern void page_map_clear ( void* start, u64 length );
+extern bool page_map_get ( const void* ptr, span_t* span ); /* false for foreign pointers */
+
+#endif
@@ -17,17 +17,34 @@
     You could see the DATA segment as:
     union {
       void* ptr; (buffer)
-      Node* nodes[3]; (parent, left and right)
+      link_t links[3]; (left, right and parent)
     }
+
+    The key (header) and both children come first, so a descent reads one
+    cache line per node in 3 of the 4 places a header can sit in a line.
+
+    Links are byte offsets from the link itself to the node it points to, 0
+    being __sentinel, so a tree stays valid wherever its memory is mapped
+    (see shared_heap.h). Always go through get_/set_parent, left and right.
  */
 
+typedef i64 link_t;
+
 typedef struct Node {
   header_t header;  
-  struct Node* parent;
-  struct Node* right;
-  struct Node* left;
+  link_t left;
+  link_t right;
+  link_t parent; /* only walked going up, after rotations */
 } node_t; 
 
+/* block layout, shared by the private and the shared heaps */
+#define PAGE 4096
+#define PAGES( size ) (((size) + (PAGE - 1)) & ~(u64)(PAGE - 1))
+#define ALIGNMENT 16
+#define ALIGN( size ) (((size) + (ALIGNMENT - 1)) & ~(u64)(ALIGNMENT - 1))
+#define MIN_SIZE ALIGN(sizeof(node_t) - sizeof(header_t)) /* a free block must hold its links */
+#define FENCES (2 * sizeof(header_t)) /* in-use, zero sized prologue and epilogue of a chunk */
+
 extern node_t* __sentinel;
 
 extern node_t* insert ( node_t** root, node_t* new_node );
@@ -38,5 +55,15 @@ extern node_t* get_node ( void* ptr );
 extern node_t* get_next_node ( node_t* node );
 extern node_t* get_prev_node ( node_t* node );  
 extern node_t* merge_nodes( node_t* a, node_t* b ); 
+extern void set_footer ( node_t* node );
+extern node_t* split_node ( node_t** root, node_t* node, u64 size );
+extern node_t* coalesce ( node_t** root, node_t* node );
+
+extern node_t* get_parent ( node_t* node );
+extern node_t* get_left ( node_t* node );
+extern node_t* get_right ( node_t* node );
+extern void set_parent ( node_t* node, node_t* parent );
+extern void set_left ( node_t* node, node_t* left );
+extern void set_right ( node_t* node, node_t* right );
 
 #endif
@@ -0,0 +1,19 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "base.h"
+
+/*
+    Per-thread counter slots, for statistics written on every allocation
+    (tags.h, latency.h). A thread claims a slot index on first use and keeps
+    it; past MAX_SHARDS threads share slots, so their counters must stay
+    atomic. Readers sum the first get_used_shards() slots.
+ */
+
+#define MAX_SHARDS 64
+#define CACHE_LINE 64 /* a shard starts on its own line, threads do not share lines */
+
+extern u64 get_shard_index ( void );
+extern u64 get_used_shards ( void );
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SHARED_HEAP_H
+#define SHARED_HEAP_H
+
+#include "base.h"
+
+/*
+    A heap living in a memfd (or any file) that several processes map, each
+    one at its own address. Blocks are handed between processes as offsets
+    from the region base; every operation takes a robust, process-shared
+    lock, so a process dying while holding it does not wedge the others.
+
+    |- - - - - -|- - - - -|- - - - - - - - - - - -|- - - - -|
+    |  REGION   | PROLOGUE|  blocks, as in a chunk | EPILOGUE|
+    |- - - - - -|- - - - -|- - - - - - - - - - - -|- - - - -|
+
+    The region does not grow: shared_allocate returns NULL when it is full.
+ */
+
+typedef struct SharedHeap shared_heap_t; /* process-local handle */
+
+extern shared_heap_t* shared_heap_create ( const char* name, u64 size ); /* backed by a new memfd */
+extern shared_heap_t* shared_heap_format ( int fd, u64 size ); /* backed by any file */
+extern shared_heap_t* shared_heap_attach ( int fd ); /* maps a region another process formatted */
+extern void shared_heap_detach ( shared_heap_t* heap ); /* the fd stays open */
+extern int shared_heap_fd ( shared_heap_t* heap );
+
+extern void* shared_allocate ( shared_heap_t* heap, u64 size );
+extern void shared_deallocate ( shared_heap_t* heap, void* ptr );
+
+extern u64 shared_offset ( shared_heap_t* heap, void* ptr );
+extern void* shared_pointer ( shared_heap_t* heap, u64 offset );
+
+#endif
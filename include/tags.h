@@ -0,0 +1,26 @@
+#ifndef TAGS_H
+#define TAGS_H
+
+#include "base.h"
+#include "header.h"
+
+/*
+    Per-subsystem accounting: a block allocated with a tag carries it in its
+    header, so deallocate finds it for free. Counters live in per-thread
+    shards and are only summed when read. Tag 0 means untagged and is not
+    counted; usable tags go from 1 to __max_tags - 1.
+ */
+
+typedef struct TagStats {
+    i64 live_bytes;     /* block sizes, rounding included */
+    u64 allocations;
+    u64 deallocations;
+} tag_stats_t;
+
+extern void* allocate_tagged ( u64 size, u8 tag );
+extern void get_tag_stats ( u8 tag, tag_stats_t* stats );
+
+extern void count_allocation ( u8 tag, u64 bytes ); /* for the allocator */
+extern void count_deallocation ( u8 tag, u64 bytes );
+
+#endif
@@ -11,5 +11,11 @@ extern bool test_malloc ( void );
 extern bool test_realloc ( void );
 extern bool test_free ( void );
 extern bool test_fragmentation ( void ); 
+extern bool test_arenas ( void );
+extern bool test_shared_heap ( void );
+extern bool test_init ( void );
+extern bool test_options ( void );
+extern bool test_tags ( void );
+extern bool test_latency ( void );
 
 #endif
@@ -1,121 +1,508 @@
 #include "../include/allocator.h"
 #include "../include/base.h"
+#include "../include/latency.h"
+#include "../include/page_map.h"
 #include "../include/rb_tree.h"
+#include "../include/tags.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/mman.h>
 
-#define PAGES( size ) (((size) + (PAGE - 1)) & ~(PAGE - 1))
-#define PAGE 4092
-#define MAX_THREADS 10
+#define MAX_THREADS (__max_arenas - N_HINTS + 1) /* thread heaps come first, hinted arenas last */
+#define HINTED_ARENA( hint ) (MAX_THREADS + (hint) - 1)
+#define CHUNK_SIZE (64 * PAGE) /* default smallest mapping asked to the OS */
+#define MMAP_THRESHOLD (1 << 20) /* default size for a mapping of its own */
+#define HUGE_PAGE (2 << 20)
+#define MAX_SIZE ((u64) 1 << 48)
+#define QUICK_MAX 512 /* bigger blocks are always coalesced as soon as they are freed */
+#define N_QUICK (QUICK_MAX / ALIGNMENT - 1) /* one list per size from MIN_SIZE to QUICK_MAX */
+#define QUICK_INDEX( size ) ((size) / ALIGNMENT - 2)
+#define QUICK_THRESHOLD 1024 /* default deferred blocks before a forced consolidation */
+#define OPTIONS_VARIABLE "MYMALLOC_OPTIONS"
 
-static u32 id_current_root = 0; 
-static node_t* current_roots[ MAX_THREADS ] = { 0 }; 
+/*
+    A chunk is carved into blocks and fenced so coalescing never walks out of it:
 
-static node_t** get_current_root ( void );
-static u16 get_current_root_id ( void ); 
+    |- - - - -|- - - -|- - - - - -|- - - -|- - - -|- - - - -|
+    | PROLOGUE| HEADER|    DATA   | FOOTER|  ...  | EPILOGUE|
+    |- - - - -|- - - -|- - - - - -|- - - -|- - - -|- - - - -|
+
+    Block sizes are multiples of ALIGNMENT, so DATA is always ALIGNMENT aligned.
+
+    Every heap (arena) owns its chunks and its free tree, the page map records
+    the owner of every chunk so blocks are freed back where they came from.
+    Hinted allocations go to an arena per lifetime so long-lived blocks do not
+    pin pages full of short-lived ones and purge() can give those back.
+
+    Small blocks are not coalesced when freed: they stay in-use with the QUICK
+    flag on, linked through their node's right link in the quick list of
+    their exact size, and are handed back as they are. They are merged into the
+    free tree in bulk when a search misses or QUICK_THRESHOLD is crossed.
+
+    Requests of at least OPTION_MMAP_THRESHOLD bytes get a chunk of their own,
+    registered as mapped in the page map, which is unmapped as soon as they
+    are freed.
+ */
+
+typedef struct Heap {
+    node_t* root;                  /* free tree */
+    node_t* quick_lists[N_QUICK];  /* freed small blocks, not coalesced yet */
+    u64 deferred;                  /* blocks sitting in quick lists */
+} heap_t;
+
+static u32 id_current_root = 0;
+static heap_t heaps[ __max_arenas ] = { 0 };
+static u64 mapped_bytes = 0;
+static u32 init_flags = 0;
+static u64 last_purge = 0; /* ms, for OPTION_PURGE_DECAY */
+
+static bool options_loaded = false;
+static i64 options[ N_OPTIONS ] = {
+    [OPTION_MMAP_THRESHOLD] = MMAP_THRESHOLD,
+    [OPTION_CHUNK_SIZE] = CHUNK_SIZE,
+    [OPTION_QUICK_MAX] = QUICK_MAX,
+    [OPTION_QUICK_THRESHOLD] = QUICK_THRESHOLD,
+    [OPTION_PURGE_DECAY] = -1,
+    [OPTION_HUGE_PAGES] = 0,
+    [OPTION_ARENAS] = N_HINTS
+};
+static const char* option_names[ N_OPTIONS ] = {
+    "mmap_threshold", "chunk_size", "quick_max", "quick_threshold", "purge_decay", "huge_pages", "arenas"
+};
+
+static heap_t* get_heap ( u16 id );
+static u16 get_current_root_id ( void );
+static void* allocate_from ( heap_t* heap, u64 size );
 static bool memcopy ( void* src, void* dest, u64 size );
+static void consolidate ( heap_t* heap );
+static void collect_stats ( node_t* node, stats_t* stats );
+static u64 purge_node ( node_t* node );
+static void* map_block ( heap_t* heap, u64 size );
+static void unmap_block ( node_t* node );
+static void maybe_purge ( void );
+static void load_options ( void );
+static bool get_span ( void* ptr, span_t* span );
 
-static node_t* add_mem_page( u64 size ) { /* syscall for mempages */
-    return  mmap(NULL, PAGES(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
-}
-
-void* allocate ( u64 size ) { 
-    void* ptr = NULL;
-    node_t** root = get_current_root(); 
-
-    if ( !root ) {
-        *root = add_mem_page( size );
-        node_t* used_node = init_node( *root, size, __red, __in_use );
-        *root = (node_t *)((u8 *)used_node + size + 2 * sizeof(header_t));
-        *root = init_node(*root, PAGES(size) - (size + 4 * sizeof(header_t)), __black, __free );  
-        ptr = (u8 *)used_node + sizeof(header_t);
-        current_roots[0] = *root; 
-    }
-    else if ( (*root)->left == (*root)->right ) { /* still splitting memory */
-        ptr = (u8 *)root + sizeof(header_t);
-        u64 new_size = get_size( (*root)->header ) - size;
-        bool status = get_status( (*root)->header );
-        bool color = get_color( (*root)->header );
-
-        if ( new_size <= size ) { /* last split in the memory segment */
-            node_t* new_node = init_node(root, new_size - sizeof(header_t), __red, __free);  
-            *root = add_mem_page(new_size);
-            *root = init_node(root, PAGES(size), __black, __free); 
-            insert( root, new_node ); 
-        }
-        
-        else  { /* main split */
-            *root = (node_t *)( (u8*) root + 2 * sizeof(header_t) + size );
-            *root = init_node( *root, size, color, status ); 
-        }
+static node_t* map_chunk ( u64 length, u8 arena, bool mapped ) { /* syscall for mempages, returns the chunk as one free node */
+    LATENCY_START( start );
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (init_flags & INIT_PREFAULT ? MAP_POPULATE : 0);
+    header_t* chunk = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if ( chunk == MAP_FAILED ) {
+        print_error("mmap failed to map a new chunk\n");
+        return NULL;
+    }
+    if ( init_flags & INIT_MLOCK && mlock(chunk, length) ) {
+        print_error("mlock failed, is RLIMIT_MEMLOCK too low?\n");
+        munmap(chunk, length);
+        return NULL;
+    }
+    if ( !page_map_set(chunk, length, arena, mapped) ) {
+        page_map_clear(chunk, length); /* the pages set before the failure must not outlive the mapping */
+        munmap(chunk, length);
+        return NULL;
+    }
+    if ( options[OPTION_HUGE_PAGES] && length >= HUGE_PAGE ) madvise(chunk, length, MADV_HUGEPAGE); /* only a hint */
+    mapped_bytes += length;
+    LATENCY_STOP( LATENCY_MMAP, start );
+
+    chunk[0] = 0; /* prologue: in-use, size 0 */
+    *(header_t *)((u8 *)chunk + length - sizeof(header_t)) = 0; /* epilogue */
+    return init_node(&chunk[1], length - FENCES - 2 * sizeof(header_t), __black, __free);
+}
 
-        current_roots[get_current_root_id()] = *root; /* update the root */
+static node_t* add_mem_page( heap_t* heap, u64 size ) { /* growth, a chunk big enough for size */
+    if ( init_flags & INIT_NO_GROW ) return NULL; /* let the user handle the NULL case */
+    u64 chunk_size = options[OPTION_CHUNK_SIZE];
+    return map_chunk( PAGES( (size + FENCES + 2 * sizeof(header_t)) > chunk_size ? size + FENCES + 2 * sizeof(header_t) : chunk_size ), heap - heaps, false );
+}
+
+bool allocator_init ( u64 reserve_bytes, u32 flags ) { /* maps the reserve now so warm allocations never hit mmap */
+    if ( reserve_bytes > MAX_SIZE ) {
+        print_error("Reserve is too big\n");
+        return false;
     }
-    else { /* now we search in a free list */
-        node_t* result = search (*root, size);
-        delete(root, result);
-        ptr = (u8 *)result + sizeof(header_t); 
+
+    load_options();
+    init_flags = flags;
+    u64 length = PAGES( reserve_bytes + FENCES + 2 * sizeof(header_t) + MIN_SIZE );
+    node_t* node = map_chunk( length, get_current_root_id(), false );
+    if ( !node ) return false;
+
+    insert( &get_heap(get_current_root_id())->root, node );
+    return true;
+}
+
+void* allocate ( u64 size ) {
+    LATENCY_START( start );
+    void* ptr = allocate_from( get_heap(get_current_root_id()), size );
+    LATENCY_STOP( LATENCY_ALLOCATE, start );
+    return ptr;
+}
+
+void* allocate_hinted ( u64 size, Hint hint ) {
+    if ( hint >= N_HINTS ) {
+        print_error("Unknown allocation hint\n");
+        return NULL;
     }
+    if ( hint == NO_HINT || hint >= options[OPTION_ARENAS] ) return allocate( size );
 
-    return ptr; /* let the user handle the NULL case */  
+    LATENCY_START( start );
+    void* ptr = allocate_from( get_heap(HINTED_ARENA(hint)), size );
+    LATENCY_STOP( LATENCY_ALLOCATE, start );
+    return ptr;
+}
+
+void* allocate_at_least ( u64 size, u64* actual ) {
+    void* ptr = allocate( size );
+    if ( actual ) *actual = ptr ? usable_size( ptr ) : 0;
+    return ptr;
+}
+
+u64 usable_size ( void* ptr ) { /* rounding, unsplit remainders and mapped pages included */
+    span_t span;
+    if ( !ptr || !get_span(ptr, &span) ) return 0;
+
+    node_t* node = get_node(ptr);
+    if ( get_status(node->header) || get_quick(node->header) ) return 0; /* freed */
+    return get_size(node->header);
+}
+
+static void* allocate_from ( heap_t* heap, u64 size ) { /* every allocation path goes through here */
+    if ( size > MAX_SIZE ) { /* before ALIGN can wrap it around to 0 */
+        print_error("Requested size is too big\n");
+        return NULL;
+    }
+
+    LATENCY_START( start );
+    size = size < MIN_SIZE ? MIN_SIZE : ALIGN(size);
+
+    if ( options[OPTION_MMAP_THRESHOLD] && size >= (u64)options[OPTION_MMAP_THRESHOLD] && !(init_flags & INIT_NO_GROW) )
+        return map_block( heap, size ); /* a heap that cannot grow serves big blocks from its reserve */
+
+    if ( size <= (u64)options[OPTION_QUICK_MAX] && heap->quick_lists[QUICK_INDEX(size)] != __sentinel ) { /* exact fit, nothing to split */
+        node_t* node = heap->quick_lists[QUICK_INDEX(size)];
+        heap->quick_lists[QUICK_INDEX(size)] = get_right(node);
+        heap->deferred--;
+        set_quick(&node->header, false);
+        LATENCY_STOP( LATENCY_QUICK_HIT, start );
+        return (u8 *)node + sizeof(header_t);
+    }
+
+    LATENCY_START( search_start );
+    node_t* node = search(heap->root, size); /* best fit in the free tree */
+    LATENCY_STOP( LATENCY_TREE_SEARCH, search_start );
+
+    if ( node == __sentinel && heap->deferred ) { /* deferred blocks may merge into a fit */
+        consolidate( heap );
+        LATENCY_START( retry_start );
+        node = search(heap->root, size);
+        LATENCY_STOP( LATENCY_TREE_SEARCH, retry_start );
+    }
+
+    if ( node == __sentinel ) node = add_mem_page( heap, size );
+    else {
+        LATENCY_START( delete_start );
+        delete( &heap->root, node );
+        LATENCY_STOP( LATENCY_TREE_DELETE, delete_start );
+    }
+
+    if ( !node ) { /* only the default heap is seeded by allocator_init, hinted arenas fall back to it */
+        heap_t* reserve = get_heap(get_current_root_id());
+        return init_flags & INIT_NO_GROW && heap != reserve ? allocate_from( reserve, size ) : NULL; /* let the user handle the NULL case */
+    }
+
+    split_node( &heap->root, node, size );
+    return (u8 *)node + sizeof(header_t);
 }
 
 void* reallocate ( void* ptr, u64 size ) {
-    void* new_ptr = allocate ( size ); 
+    if ( !ptr ) return allocate( size );
+
+    span_t span;
+    if ( !get_span(ptr, &span) ) {
+        print_error("Reallocating a pointer this allocator does not own\n");
+        return NULL;
+    }
+
+    node_t* node = get_node(ptr);
+    if ( get_status(node->header) || get_quick(node->header) ) {
+        print_error("Reallocating a free pointer\n");
+        return NULL;
+    }
+    if ( get_size(node->header) >= size ) return ptr; /* it already fits */
+
+    LATENCY_START( start );
+
+    void* new_ptr = allocate_from ( get_heap(span.arena), size ); /* stays in its arena */
     if ( !new_ptr ) {
-        print_error("Malloc function returned NULL ptr\n"); 
+        print_error("Malloc function returned NULL ptr\n");
         return NULL;
     }
-    return memcopy(ptr, new_ptr, size) ? new_ptr : NULL; /* let the user handle the NULL case */ 
+    if ( !memcopy(ptr, new_ptr, get_size(node->header)) ) return NULL; /* let the user handle the NULL case */
+
+    u8 tag = get_tag(node->header);
+    if ( tag ) { /* the tag follows the data, deallocate below accounts the old block */
+        node_t* new_node = get_node(new_ptr);
+        set_tag(&new_node->header, tag);
+        count_allocation(tag, get_size(new_node->header));
+    }
+
+    deallocate( ptr );
+    LATENCY_STOP( LATENCY_REALLOCATE, start );
+    return new_ptr;
 }
 
 void deallocate ( void* ptr ) {
-    node_t* node = (node_t *) ((u8*) ptr - sizeof(header_t));
+    if ( !ptr ) return;
+
+    span_t span; /* before touching the header, which may not exist */
+    if ( !get_span(ptr, &span) ) {
+        print_error("Freeing a pointer this allocator does not own\n");
+        return;
+    }
+
+    node_t* node = get_node(ptr);
+
+    if ( get_status(node->header) || get_quick(node->header) ) {
+        print_error("Double free operation\n");
+        return;
+    }
+
+    LATENCY_START( start );
+    u8 tag = get_tag(node->header);
+    if ( tag ) {
+        count_deallocation(tag, get_size(node->header));
+        set_tag(&node->header, 0); /* quick lists hand blocks back as they are */
+    }
+
+    heap_t* heap = get_heap(span.arena); /* the span's owner, whichever thread frees it */
+    u64 size = get_size(node->header);
+
+    if ( span.mapped ) unmap_block( node );
+    else if ( size > (u64)options[OPTION_QUICK_MAX] ) {
+        coalesce( &heap->root, node );
+        maybe_purge();
+    }
+    else { /* defer: park it in-use so its neighbours do not merge with it yet */
+        set_quick(&node->header, true);
+        set_right(node, heap->quick_lists[QUICK_INDEX(size)]);
+        heap->quick_lists[QUICK_INDEX(size)] = node;
+        if ( ++heap->deferred > (u64)options[OPTION_QUICK_THRESHOLD] ) consolidate( heap );
+    }
+
+    LATENCY_STOP( LATENCY_DEALLOCATE, start );
+}
+
+bool allocator_set_option ( Option key, i64 value ) {
+    load_options(); /* explicit settings win over the environment */
+
+    switch ( key ) {
+        case OPTION_MMAP_THRESHOLD:
+        case OPTION_QUICK_THRESHOLD:
+            if ( value < 0 ) break;
+            options[key] = value;
+            return true;
+        case OPTION_CHUNK_SIZE:
+            if ( value < PAGE || (u64)value > MAX_SIZE ) break;
+            options[key] = PAGES(value);
+            return true;
+        case OPTION_QUICK_MAX:
+            if ( value < 0 || value > QUICK_MAX ) break;
+            options[key] = value;
+            return true;
+        case OPTION_PURGE_DECAY:
+            if ( value < -1 ) break;
+            options[key] = value;
+            return true;
+        case OPTION_HUGE_PAGES:
+            if ( value != 0 && value != 1 ) break;
+            options[key] = value;
+            return true;
+        case OPTION_ARENAS:
+            if ( value < 1 || value > N_HINTS ) break;
+            options[key] = value;
+            return true;
+        default:
+            break;
+    }
+
+    print_error("Invalid allocator option\n");
+    return false;
+}
+
+i64 allocator_get_option ( Option key ) {
+    load_options();
+    return key < N_OPTIONS ? options[key] : -1;
+}
+
+bool allocator_parse_options ( const char* spec ) { /* key=value[k|m|g],key=value... */
+    bool result = true;
+
+    while ( spec && *spec ) {
+        const char* end = strchr(spec, ',');
+        if ( !end ) end = spec + strlen(spec);
+        const char* equals = memchr(spec, '=', end - spec);
+
+        Option key = N_OPTIONS;
+        for ( Option o = 0; equals && o < N_OPTIONS; o++ )
+            if ( strlen(option_names[o]) == (u64)(equals - spec) && !strncmp(spec, option_names[o], equals - spec) ) key = o;
+
+        char* suffix = NULL;
+        bool hex = equals && equals[1] == '0' && (equals[2] == 'x' || equals[2] == 'X'); /* decimal otherwise, 010 is ten */
+        errno = 0;
+        i64 value = key < N_OPTIONS ? strtoll(equals + 1, &suffix, hex ? 16 : 10) : 0;
+        bool parsed = key < N_OPTIONS && suffix != equals + 1 && errno != ERANGE;
+        if ( parsed && suffix < end ) {
+            u32 shift = 0;
+            switch ( *suffix++ ) {
+                case 'k': case 'K': shift = 10; break;
+                case 'm': case 'M': shift = 20; break;
+                case 'g': case 'G': shift = 30; break;
+                default: parsed = false;
+            }
+            if ( value < 0 || value > INT64_MAX >> shift ) parsed = false; /* shifting would overflow */
+            else value <<= shift;
+        }
 
-    if ( get_status(node->header) ) {
-        print_error("Double free operation\n"); 
-        return;     
+        if ( !parsed || suffix != end || !allocator_set_option(key, value) ) {
+            print_error("Ignoring malformed allocator option\n");
+            result = false;
+        }
+        spec = *end ? end + 1 : end;
     }
 
-    set_status(&node->header, __free);
+    return result;
+}
 
-    header_t prev_footer = (header_t)( (u8*)node - sizeof(header_t) );
-    node_t* prev_node = (node_t *)( (u8*)node - (2 * sizeof(header_t) + get_size(prev_footer)) ); 
-    node_t* next_node = (node_t *)( (u8*)node + 2 * sizeof(header_t) + get_size(node->header) );
+void get_stats ( stats_t* stats ) { /* consolidates first, like allocate would on a miss */
+    stats->mapped_bytes = mapped_bytes;
+    stats->free_bytes = stats->free_blocks = stats->largest_free = 0;
+    for ( u16 id = 0; id < __max_arenas; id++ ) {
+        heap_t* heap = get_heap(id);
+        consolidate( heap );
+        collect_stats(heap->root, stats);
+    }
+}
 
-    /* merge nodes */    
-    node_t* merged_node = __sentinel;
-        if ( get_status(prev_node->header) ) {
-        delete(get_current_root(), prev_node);
-        merged_node = merge_nodes(prev_node, node); 
+u64 purge ( void ) {
+    if ( init_flags & (INIT_PREFAULT | INIT_MLOCK) ) return 0; /* those pages are meant to stay */
+
+    LATENCY_START( start );
+    u64 purged = 0;
+    for ( u16 id = 0; id < __max_arenas; id++ ) {
+        heap_t* heap = get_heap(id);
+        consolidate( heap );
+        purged += purge_node( heap->root );
     }
+    LATENCY_STOP( LATENCY_PURGE, start );
+    return purged;
+}
+
+static void* map_block ( heap_t* heap, u64 size ) { /* a chunk holding a single block, unmapped on free */
+    if ( init_flags & INIT_NO_GROW ) return NULL;
+
+    node_t* node = map_chunk( PAGES( size + FENCES + 2 * sizeof(header_t) ), heap - heaps, true );
+    if ( !node ) return NULL;
+
+    init_node(node, get_size(node->header), __red, __in_use);
+    return (u8 *)node + sizeof(header_t);
+}
+
+static void unmap_block ( node_t* node ) {
+    LATENCY_START( start );
+    u64 length = get_size(node->header) + FENCES + 2 * sizeof(header_t);
+    page_map_clear((u8 *)node - sizeof(header_t), length);
+    munmap((u8 *)node - sizeof(header_t), length);
+    mapped_bytes -= length;
+    LATENCY_STOP( LATENCY_MMAP, start );
+}
+
+static void maybe_purge ( void ) { /* purges at most once every OPTION_PURGE_DECAY ms */
+    if ( options[OPTION_PURGE_DECAY] < 0 ) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u64 ms = (u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    if ( ms - last_purge < (u64)options[OPTION_PURGE_DECAY] ) return;
 
-    if ( get_status(next_node->header) ) {
-        delete(get_current_root(), next_node);
-        merged_node = merged_node == __sentinel ? merge_nodes(node, next_node) : merge_nodes(merged_node, next_node); 
+    last_purge = ms;
+    purge();
+}
+
+static bool get_span ( void* ptr, span_t* span ) { /* the span of a pointer this allocator handed out */
+    if ( !page_map_get(ptr, span) ) return false;
+    /* a mapped block has exactly one valid pointer, anything else would read user data as a header */
+    return !span->mapped || (u8 *)ptr == (u8 *)span->start + 2 * sizeof(header_t);
+}
+
+static void load_options ( void ) { /* once, from the environment */
+    if ( options_loaded ) return;
+    options_loaded = true;
+    const char* spec = getenv(OPTIONS_VARIABLE);
+    if ( spec ) allocator_parse_options(spec);
+}
+
+static void consolidate ( heap_t* heap ) { /* moves every deferred block into the free tree */
+    for ( u64 i = 0; i < N_QUICK; i++ ) {
+        node_t* node = heap->quick_lists[i];
+        while ( node != __sentinel ) {
+            node_t* next = get_right(node);
+            coalesce( &heap->root, node );
+            node = next;
+        }
+        heap->quick_lists[i] = __sentinel;
     }
+    heap->deferred = 0;
+}
 
-    if ( merged_node == __sentinel ) insert(get_current_root(), node);
-    else insert(get_current_root(), merged_node); 
+static void collect_stats ( node_t* node, stats_t* stats ) {
+    if ( node == __sentinel ) return;
+    u64 size = get_size(node->header);
+    stats->free_bytes += size;
+    stats->free_blocks++;
+    if ( size > stats->largest_free ) stats->largest_free = size;
+    collect_stats(get_left(node), stats);
+    collect_stats(get_right(node), stats);
 }
 
-static bool memcopy( void* src, void* dest, u64 size ) { 
+static u64 purge_node ( node_t* node ) { /* drops the pages strictly inside free blocks, node and footer stay */
+    if ( node == __sentinel ) return 0;
+
+    u64 start = PAGES( (u64)node + sizeof(node_t) );
+    u64 end = ((u64)get_next_node(node) - sizeof(header_t)) & ~(u64)(PAGE - 1);
+    u64 purged = 0;
+    if ( end > start && !madvise((void *)start, end - start, MADV_DONTNEED) ) purged = end - start;
+
+    return purged + purge_node(get_left(node)) + purge_node(get_right(node));
+}
+
+static bool memcopy( void* src, void* dest, u64 size ) {
     u8* src_aux = src;
     u8* dest_aux = dest;
 
-    if ( src + size == dest || dest + size == src ) {
+    if ( src_aux < dest_aux + size && dest_aux < src_aux + size ) {
         print_error("overlapping memory segments\n");
-        return false; 
+        return false;
     }
-    
-    for ( u64 i = 0; i < size; i++ ) dest_aux[i] = src_aux[i];  
+
+    for ( u64 i = 0; i < size; i++ ) dest_aux[i] = src_aux[i];
 
     return true;
 }
 
-node_t** get_current_root ( void ) { /* will help to mange threads */
-    return current_roots[0]->header == 0 ? NULL : &current_roots[0]; 
+heap_t* get_heap ( u16 id ) { /* thread heaps by root id, then hinted arenas */
+    heap_t* heap = &heaps[id];
+    if ( !heap->root ) { /* first use */
+        load_options();
+        heap->root = __sentinel;
+        for ( u64 i = 0; i < N_QUICK; i++ ) heap->quick_lists[i] = __sentinel;
+    }
+    return heap;
 }
 
 u16 get_current_root_id ( void ) { /* main root is 0 */
-    return 0; 
+    return id_current_root;
 }
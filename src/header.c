@@ -2,31 +2,39 @@
 
 #define MSB ((sizeof(header_t) * 8) - 1) /* most significant bit */
 #define SECOND_MSB (MSB - 1)
+#define THIRD_MSB (MSB - 2)
+#define SIZE_MASK (((u64) 1 << 48) - 1)
+#define TAG_SHIFT 52
+#define TAG_MASK ((u64)(__max_tags - 1) << TAG_SHIFT)
 
 u64 get_size ( header_t header ) {
-    u64 size = header;
-    size = size & ~( (u64) 1 << MSB ) ; 
-    return size & ~( (u64) 1 << SECOND_MSB ); 
+    return header & SIZE_MASK;
 }
 
 bool get_color ( header_t header ) { /* second MSB */
-    return header >> SECOND_MSB;
+    return (header >> SECOND_MSB) & 1;
 }
 
 bool get_status ( header_t header ) { /* MSB */
     return header >> MSB;
 }
 
+bool get_quick ( header_t header ) { /* third MSB */
+    return (header >> THIRD_MSB) & 1;
+}
+
+
+u8 get_tag ( header_t header ) { /* bits 52 - 56 */
+    return (header & TAG_MASK) >> TAG_SHIFT;
+}
+
 void set_size ( header_t* header, u64 size ) {
-    if ( get_color (size) || get_status(size) ) {
-        print_error("Size can't have 63th or 64th bits on\n");
+    if ( size & ~SIZE_MASK ) {
+        print_error("Size can't use more than 48 bits\n");
         return; 
     }
     
-    header_t current_header = size; 
-    set_color( &current_header, get_color(*header) );
-    set_status( &current_header, get_status(*header) );
-    *header = current_header;  
+    *header = (*header & ~SIZE_MASK) | size; /* flags are kept */
 }
 
 void set_color ( header_t* header, bool color ) {
@@ -36,3 +44,15 @@ void set_color ( header_t* header, bool color ) {
 void set_status ( header_t* header, bool status ) {
     *header = (*header & ~((u64) 1 << MSB) | ((u64)status << MSB)); 
 }
+
+void set_quick ( header_t* header, bool quick ) {
+    *header = (*header & ~((u64) 1 << THIRD_MSB) | ((u64)quick << THIRD_MSB));
+}
+
+void set_tag ( header_t* header, u8 tag ) {
+    if ( tag >= __max_tags ) {
+        print_error("Tag out of range\n");
+        return;
+    }
+    *header = (*header & ~TAG_MASK) | ((u64)tag << TAG_SHIFT);
+}
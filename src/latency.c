@@ -0,0 +1,77 @@
+#include "../include/latency.h"
+#include "../include/base.h"
+#include "../include/shard.h"
+#include <stdatomic.h>
+
+#ifdef MYMALLOC_LATENCY
+typedef struct Shard { /* one thread's histograms */
+    _Alignas(CACHE_LINE) _Atomic u64 cycles[N_LATENCY_PATHS];
+    _Atomic u64 buckets[N_LATENCY_PATHS][LATENCY_BUCKETS];
+} shard_t;
+
+static shard_t shards[ MAX_SHARDS ];
+
+static u32 get_bucket ( u64 cycles );
+#endif
+
+bool get_latency_stats ( LatencyPath path, latency_stats_t* stats ) { /* sums every shard */
+    stats->count = stats->cycles = 0;
+    for ( u32 b = 0; b < LATENCY_BUCKETS; b++ ) stats->buckets[b] = 0;
+
+#ifdef MYMALLOC_LATENCY
+    if ( path >= N_LATENCY_PATHS ) return false;
+
+    for ( u64 i = 0; i < get_used_shards(); i++ ) {
+        stats->cycles += atomic_load_explicit(&shards[i].cycles[path], memory_order_relaxed);
+        for ( u32 b = 0; b < LATENCY_BUCKETS; b++ ) {
+            u64 count = atomic_load_explicit(&shards[i].buckets[path][b], memory_order_relaxed);
+            stats->buckets[b] += count;
+            stats->count += count;
+        }
+    }
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+u64 latency_percentile ( const latency_stats_t* stats, double fraction ) {
+    if ( !stats->count ) return 0;
+
+    u64 rank = (u64)(fraction * stats->count);
+    if ( rank >= stats->count ) rank = stats->count - 1;
+
+    u64 seen = 0;
+    for ( u32 b = 0; b < LATENCY_BUCKETS; b++ ) {
+        seen += stats->buckets[b];
+        if ( seen > rank ) return b + 1 < LATENCY_BUCKETS ? latency_bucket_floor(b + 1) - 1 : ~0ULL;
+    }
+    return ~0ULL;
+}
+
+u64 latency_bucket_floor ( u32 bucket ) { /* smallest latency landing in bucket */
+    if ( bucket < LATENCY_SUB_BUCKETS ) return bucket;
+    u32 exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    u64 mantissa = LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS;
+    return mantissa << (exponent - LATENCY_SUB_BITS);
+}
+
+void record_latency ( LatencyPath path, u64 cycles ) {
+#ifdef MYMALLOC_LATENCY
+    shard_t* shard = &shards[ get_shard_index() ];
+    atomic_fetch_add_explicit(&shard->cycles[path], cycles, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->buckets[path][get_bucket(cycles)], 1, memory_order_relaxed);
+#else
+    (void)path;
+    (void)cycles;
+#endif
+}
+
+#ifdef MYMALLOC_LATENCY
+static u32 get_bucket ( u64 cycles ) { /* inverse of latency_bucket_floor */
+    if ( cycles < LATENCY_SUB_BUCKETS ) return cycles;
+    u32 exponent = 63 - __builtin_clzll(cycles);
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + ((cycles >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+#endif
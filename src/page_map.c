@@ -0,0 +1,96 @@
+#include "../include/page_map.h"
+#include "../include/base.h"
+#include "../include/header.h"
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#define PAGE_SHIFT 12
+#define LEVEL_BITS 12
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define ADDRESS_BITS 48
+#define ROOT_INDEX( page ) ((page) >> (2 * LEVEL_BITS))
+#define MID_INDEX( page ) (((page) >> LEVEL_BITS) & LEVEL_MASK)
+#define LEAF_INDEX( page ) ((page) & LEVEL_MASK)
+
+/* leaf entry: | VALID 63 | MAPPED 62 | - | ARENA 39 ... 36 | START PAGE 35 ... 0 | */
+#define VALID ((u64)1 << 63)
+#define MAPPED ((u64)1 << 62)
+#define ARENA_SHIFT 36
+#define START_MASK (((u64)1 << (ADDRESS_BITS - PAGE_SHIFT)) - 1)
+
+typedef struct Leaf {
+    _Atomic u64 entries[ LEVEL_SIZE ];
+} leaf_t;
+
+typedef struct Mid {
+    _Atomic(leaf_t*) leaves[ LEVEL_SIZE ];
+} mid_t;
+
+static _Atomic(mid_t*) root[ LEVEL_SIZE ] = { 0 };
+
+static void* get_level ( void* _Atomic* slot, u64 size ); /* installs the node on first use */
+
+bool page_map_set ( void* start, u64 length, u8 arena, bool mapped ) {
+    u64 first = (u64)start >> PAGE_SHIFT;
+    u64 last = ((u64)start + length - 1) >> PAGE_SHIFT;
+    if ( last >> (ADDRESS_BITS - PAGE_SHIFT) ) {
+        print_error("Address out of the page map range\n");
+        return false;
+    }
+
+    u64 entry = VALID | (mapped ? MAPPED : 0) | ((u64)(arena & (__max_arenas - 1)) << ARENA_SHIFT) | first;
+    for ( u64 page = first; page <= last; page++ ) {
+        mid_t* mid = get_level((void* _Atomic*)&root[ROOT_INDEX(page)], sizeof(mid_t));
+        if ( !mid ) return false;
+        leaf_t* leaf = get_level((void* _Atomic*)&mid->leaves[MID_INDEX(page)], sizeof(leaf_t));
+        if ( !leaf ) return false;
+        atomic_store_explicit(&leaf->entries[LEAF_INDEX(page)], entry, memory_order_release);
+    }
+    return true;
+}
+
+void page_map_clear ( void* start, u64 length ) { /* nodes stay, lookups may still be walking them */
+    u64 first = (u64)start >> PAGE_SHIFT;
+    u64 last = ((u64)start + length - 1) >> PAGE_SHIFT;
+    if ( last >> (ADDRESS_BITS - PAGE_SHIFT) ) return;
+
+    for ( u64 page = first; page <= last; page++ ) {
+        mid_t* mid = atomic_load_explicit(&root[ROOT_INDEX(page)], memory_order_acquire);
+        leaf_t* leaf = mid ? atomic_load_explicit(&mid->leaves[MID_INDEX(page)], memory_order_acquire) : NULL;
+        if ( leaf ) atomic_store_explicit(&leaf->entries[LEAF_INDEX(page)], 0, memory_order_release);
+    }
+}
+
+bool page_map_get ( const void* ptr, span_t* span ) {
+    u64 page = (u64)ptr >> PAGE_SHIFT;
+    if ( page >> (ADDRESS_BITS - PAGE_SHIFT) ) return false;
+
+    mid_t* mid = atomic_load_explicit(&root[ROOT_INDEX(page)], memory_order_acquire);
+    if ( !mid ) return false;
+    leaf_t* leaf = atomic_load_explicit(&mid->leaves[MID_INDEX(page)], memory_order_acquire);
+    if ( !leaf ) return false;
+    u64 entry = atomic_load_explicit(&leaf->entries[LEAF_INDEX(page)], memory_order_acquire);
+    if ( !(entry & VALID) ) return false;
+
+    span->start = (void *)((entry & START_MASK) << PAGE_SHIFT);
+    span->arena = (entry >> ARENA_SHIFT) & (__max_arenas - 1);
+    span->mapped = entry & MAPPED;
+    return true;
+}
+
+static void* get_level ( void* _Atomic* slot, u64 size ) {
+    void* node = atomic_load_explicit(slot, memory_order_acquire);
+    if ( node ) return node;
+
+    void* fresh = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); /* zeroed */
+    if ( fresh == MAP_FAILED ) {
+        print_error("mmap failed to grow the page map\n");
+        return NULL;
+    }
+    if ( !atomic_compare_exchange_strong_explicit(slot, &node, fresh, memory_order_acq_rel, memory_order_acquire) ) {
+        munmap(fresh, size); /* another thread won, node holds its copy */
+        return node;
+    }
+    return fresh;
+}
@@ -1,146 +1,211 @@
 #include "../include/base.h"
+#include "../include/latency.h"
 #include "../include/rb_tree.h"
 #include <stdbool.h>
 #include <stdio.h>
 
-static node_t __sentinel_value = {
-  0, &__sentinel_value, &__sentinel_value, &__sentinel_value
-};
+static const node_t __sentinel_value = { 0, 0, 0, 0 }; /* links to itself: every link is 0 */
 
-node_t* __sentinel = &__sentinel_value; 
+node_t* __sentinel = (node_t *)&__sentinel_value; /* read only: trees in different heaps share it */
 
 typedef enum ChildKind {
     LEFT,
     RIGHT,
     ROOT
-} ChildKind; 
+} ChildKind;
 
 /* Some helpers */
 
-static void set_footer ( node_t* node ); 
+static node_t* decode_link ( link_t* link );
+static void encode_link ( link_t* link, node_t* node );
 static header_t* get_footer ( node_t* node );
-static node_t* get_substitute ( node_t* node );  
-static void disconnect_node ( node_t* node ); 
+static node_t* get_minimum ( node_t* node );
+static void disconnect_node ( node_t* node );
+static void transplant ( node_t** root, node_t* old_node, node_t* new_node );
 static void left_rotate ( node_t** root, node_t* node );
 static void right_rotate ( node_t** root, node_t* node );
-static void left_right_rotate ( node_t** root, node_t* node );
-static void right_left_rotate ( node_t** root, node_t* node ); 
-static bool fix_deletion ( node_t** root, node_t* result, bool black_token );
-static bool fix_subtree ( node_t** root, node_t* current_subtree ); 
-static void swap_nodes ( node_t* inorder, node_t* node ); /* Just changes the tree hierarchy */
-static ChildKind get_child_kind ( node_t* node ); 
+static bool fix_deletion ( node_t** root, node_t* current, node_t* parent );
+static bool fix_subtree ( node_t** root, node_t* current_subtree );
+static ChildKind get_child_kind ( node_t* node );
 
 /* Implementations */
 
-node_t* insert ( node_t** root, node_t* new_node ) { /* top-down insertion */
+node_t* insert ( node_t** root, node_t* new_node ) { /* bottom-up insertion, equal sizes go right */
     u64 target = get_size(new_node->header);
     node_t* current = *root;
-    node_t* parent = __sentinel; 
+    node_t* parent = __sentinel;
 
     while ( current != __sentinel ) {
-        parent = current; 
-        current = target < get_size(current->header) ? current->left : current->right;
-        if ( get_color(current->left->header) && get_color(current->right->header) )
-            fix_subtree(root, current); 
+        parent = current;
+        current = target < get_size(current->header) ? get_left(current) : get_right(current);
     }
 
     /* insert node */
-    node_t** child = target < get_size(parent->header) ? &parent->left : &parent->right;
-    *child = new_node;
-    (*child)->parent = parent;
-        
-    /* perform last fix if needed */
-    fix_subtree(root, *child);  
-    
-    return new_node;     
+    set_parent(new_node, parent);
+    set_left(new_node, __sentinel);
+    set_right(new_node, __sentinel);
+    set_color(&new_node->header, __red);
+
+    if ( parent == __sentinel ) *root = new_node;
+    else if ( target < get_size(parent->header) ) set_left(parent, new_node);
+    else set_right(parent, new_node);
+
+    /* perform fixes going up */
+    fix_subtree(root, new_node);
+
+    return new_node;
 }
 
 node_t* delete ( node_t** root, node_t* node ) { /* bottom-up deletion */
     if ( !root || *root == __sentinel ) {
         print_error("Corrupted tree: root == NULL\n");
-        return NULL; 
+        return NULL;
     }
 
     else if ( !node || node == __sentinel ) {
         print_error("Cannot delete a NULL pointer\n");
-        return NULL; 
+        return NULL;
     }
 
-    node_t* result = get_substitute(node);
-    node_t* parent = node->parent;
-    node_t** new_child = node == *root ?
-                        &(*root) : (parent->left == node ? &parent->left : &parent->right); 
-    
-    bool black_token = !get_color(node->header); 
- 
-    if ( result == __sentinel ) { /* no child */
-        (*new_child) = __sentinel; 
-        disconnect_node(node); 
+    node_t* substitute = node; /* node that actually leaves its position */
+    node_t* current = __sentinel; /* node that takes substitute's position */
+    node_t* parent = get_parent(node); /* current's parent, kept here since current may be __sentinel */
+    bool black_token = !get_color(substitute->header);
+
+    if ( get_left(node) == __sentinel ) { /* at most a right child */
+        current = get_right(node);
+        transplant(root, node, current);
     }
-    else if ( result == node->left || result == node->right ) { /* one child */
-        (*new_child) = result;
-        (*new_child)->left = result->left;
-        (*new_child)->right = result->right;
-        (*new_child)->parent = new_child == &(*root) ? __sentinel : parent; 
-        disconnect_node(node);
+    else if ( get_right(node) == __sentinel ) { /* only a left child */
+        current = get_left(node);
+        transplant(root, node, current);
     }
-    else { /* two child */
-        swap_nodes(result, node);
-        delete(root, node); 
+    else { /* two children: the inorder successor takes node's place */
+        substitute = get_minimum(get_right(node));
+        black_token = !get_color(substitute->header);
+        current = get_right(substitute);
+
+        if ( get_parent(substitute) == node ) parent = substitute; /* current stays its right child */
+        else {
+            parent = get_parent(substitute);
+            transplant(root, substitute, current);
+            set_right(substitute, get_right(node));
+            set_parent(get_right(substitute), substitute);
+        }
+
+        transplant(root, node, substitute);
+        set_left(substitute, get_left(node));
+        set_parent(get_left(substitute), substitute);
+        set_color(&substitute->header, get_color(node->header));
     }
 
-    fix_deletion(root, result, black_token);
-        
-    return node; 
+    if ( black_token ) fix_deletion(root, current, parent);
+
+    disconnect_node(node);
+
+    return node;
 }
 
 node_t* init_node ( void* ptr, u64 size, bool color, bool status ) { /* init node assumes that ptr will be node's address */
     node_t* node = ptr;
-    set_color(&node->header, color);
-    set_status(&node->header,  status);
-    set_size(&node->header, size);
+    header_t header = 0; /* a new node carries no stale flags */
+    set_color(&header, color);
+    set_status(&header,  status);
+    set_size(&header, size);
+    node->header = header; /* one store: a process killed here leaves the old header or the new one */
     set_footer(node);
-    node->parent = __sentinel;
-    node->left = __sentinel;
-    node->right = __sentinel;
-    return node; 
+    disconnect_node(node);
+    return node;
 }
 
-node_t* search ( node_t* root, u64 target ) { /* best fit algorithm */
+node_t* search ( node_t* root, u64 target ) { /* best fit algorithm, __sentinel if nothing fits */
     node_t* current = root;
-    while ( current->left != __sentinel && current->right != __sentinel ) {
-        if ( get_size(current->header) == target ) break; 
-        current = target < get_size(current->header) ? current->left : current->right;  
+    node_t* best = __sentinel;
+    while ( current != __sentinel ) {
+        node_t* left = get_left(current);
+        node_t* right = get_right(current);
+        __builtin_prefetch(left); /* both, before the comparison picks one */
+        __builtin_prefetch(right);
+        u64 size = get_size(current->header);
+        if ( size == target ) return current;
+        if ( size > target ) {
+            best = current;
+            current = left;
+        }
+        else current = right;
     }
-    return current; 
+    return best;
 }
 
 node_t* get_node ( void* ptr ) { /* get_node assumes ptr = (u8 *)original_node + sizeof(Header); */
-    return (node_t *)((u8 *)ptr - sizeof(header_t)); 
+    return (node_t *)((u8 *)ptr - sizeof(header_t));
 }
 
 node_t* merge_nodes ( node_t* a, node_t* b ) { /* merge_nodes assumes a and b are free memory contiguous nodes */
     node_t* left = a < b ? a : b;
-    node_t* right = left == a ? b : a; 
+    node_t* right = left == a ? b : a;
 
     if ( right != get_next_node(left) ) {
         print_error("Trying to merge non-memory-contiguous nodes\n");
-        return __sentinel;  
+        return __sentinel;
     }
-    
-    if ( get_status(a->header) || get_status(b->header) ) {
+
+    if ( !get_status(a->header) || !get_status(b->header) ) {
         print_error("Trying to merge non-free nodes\n");
-        return __sentinel; 
+        return __sentinel;
+    }
+
+    u64 new_size = get_size(a->header) + get_size(b->header) + 2 * sizeof(header_t);
+    left = init_node(left, new_size, __red, __free);
+
+    return left;
+}
+
+node_t* split_node ( node_t** root, node_t* node, u64 size ) { /* node leaves in use, the tail goes back to the tree */
+    u64 node_size = get_size(node->header);
+
+    if ( node_size - size < MIN_SIZE + 2 * sizeof(header_t) ) { /* tail too small to be a free block */
+        return init_node(node, node_size, __red, __in_use);
+    }
+
+    /* tail first: until the head's header shrinks, the block still reads as a whole (see rebuild_tree) */
+    node_t* tail = init_node((u8 *)node + size + 2 * sizeof(header_t), node_size - size - 2 * sizeof(header_t), __red, __free);
+    init_node(node, size, __red, __in_use);
+    LATENCY_START( start );
+    insert(root, tail);
+    LATENCY_STOP( LATENCY_TREE_INSERT, start );
+    return node;
+}
+
+node_t* coalesce ( node_t** root, node_t* node ) { /* frees node, merges it with free neighbours and inserts it */
+    node = init_node(node, get_size(node->header), __red, __free);
+
+    /* merge nodes, in-use fences around a chunk keep us inside it */
+    header_t prev_footer = *(header_t *)( (u8*)node - sizeof(header_t) );
+    if ( get_status(prev_footer) ) {
+        node_t* prev_node = get_prev_node(node);
+        LATENCY_START( start );
+        delete(root, prev_node);
+        LATENCY_STOP( LATENCY_TREE_DELETE, start );
+        node = merge_nodes(prev_node, node);
     }
 
-    u64 new_size = get_size(a->header) + get_size(b->header) + 2 * sizeof(header_t); 
-    left = init_node(left, new_size, __red, __free); 
+    node_t* next_node = get_next_node(node);
+    if ( get_status(next_node->header) ) {
+        LATENCY_START( start );
+        delete(root, next_node);
+        LATENCY_STOP( LATENCY_TREE_DELETE, start );
+        node = merge_nodes(node, next_node);
+    }
 
-    return left; 
+    LATENCY_START( start );
+    node = insert(root, node);
+    LATENCY_STOP( LATENCY_TREE_INSERT, start );
+    return node;
 }
 
 node_t* get_next_node ( node_t* node ) {
-    return (node_t *)( (u8 *)get_footer(node) + sizeof(header_t) ); 
+    return (node_t *)( (u8 *)get_footer(node) + sizeof(header_t) );
 }
 
 node_t* get_prev_node ( node_t* node ) {
@@ -148,188 +213,170 @@ node_t* get_prev_node ( node_t* node ) {
     return (node_t *) ((u8 *)prev_footer - sizeof(header_t) - get_size(*prev_footer));
 }
 
+void set_footer ( node_t* node ) { /* A node's footer must be equal to its header */
+    header_t* footer = get_footer(node);
+    *footer = node->header;
+}
+
+node_t* get_parent ( node_t* node ) {
+    return decode_link(&node->parent);
+}
+
+node_t* get_left ( node_t* node ) {
+    return decode_link(&node->left);
+}
+
+node_t* get_right ( node_t* node ) {
+    return decode_link(&node->right);
+}
+
+void set_parent ( node_t* node, node_t* parent ) {
+    encode_link(&node->parent, parent);
+}
+
+void set_left ( node_t* node, node_t* left ) {
+    encode_link(&node->left, left);
+}
+
+void set_right ( node_t* node, node_t* right ) {
+    encode_link(&node->right, right);
+}
+
 /* Helper implementations */
 
-void set_footer (node_t* node) { /* A node's footer must be equal to its header */
-    header_t* footer = get_footer(node);
-    *footer = node->header; 
+static node_t* decode_link ( link_t* link ) { /* links are relative to themselves, 0 is the sentinel */
+    return *link ? (node_t *)((u8 *)link + *link) : __sentinel;
+}
+
+static void encode_link ( link_t* link, node_t* node ) {
+    *link = node == __sentinel ? 0 : (u8 *)node - (u8 *)link;
 }
 
 static header_t* get_footer ( node_t* node ) {
     return (header_t *)( (u8 *)node + sizeof(header_t) + get_size(node->header) );
 }
 
+static node_t* get_minimum ( node_t* node ) {
+    while ( get_left(node) != __sentinel ) node = get_left(node);
+    return node;
+}
+
 static void disconnect_node ( node_t* node ) {
-    node->parent = node->left = node->right = __sentinel; 
+    node->parent = node->left = node->right = 0;
 }
 
 static ChildKind get_child_kind( node_t* child ) {
-    return child->parent == __sentinel ? ROOT : ( child->parent->left == child ? LEFT : RIGHT ); 
+    node_t* parent = get_parent(child);
+    return parent == __sentinel ? ROOT : ( get_left(parent) == child ? LEFT : RIGHT );
 }
 
-static void left_rotate ( node_t** root,  node_t* node ) { /* perform rotation by pushing node down and indirect linking */
-    node_t* current_parent = node;
-    node_t* current_right = node->right;
-    node_t* new_right = current_right->left; 
-
-    node_t** new_node = node != *root ?
-                        ((node->parent)->left == node ? &(node->parent)->left : &(node->parent)->right) : root;
-    
-    *new_node = current_right;
-    (*new_node)->left = current_parent;
-    (*new_node)->parent = current_parent->parent;
-
-    current_parent->parent = *new_node;
-    current_parent->right = new_right;
-    new_right->parent = current_parent; 
+static void transplant ( node_t** root, node_t* old_node, node_t* new_node ) { /* new_node takes old_node's place under its parent */
+    node_t* parent = get_parent(old_node);
+    switch ( get_child_kind(old_node) ) {
+        case ROOT: *root = new_node; break;
+        case LEFT: set_left(parent, new_node); break;
+        case RIGHT: set_right(parent, new_node); break;
+    }
+    if ( new_node != __sentinel ) set_parent(new_node, parent); /* the sentinel is shared by every tree */
 }
 
-static void right_rotate ( node_t** root, node_t* node ) {
-    node_t* current_parent = node;
-    node_t* current_left = node->left;
-    node_t* new_left = current_left->right;
-
-    node_t** new_node = node != *root ?
-                        ((node->parent)->left == node ? &(node->parent)->left : &(node->parent)->right) : root;
-    
-    *new_node = current_left;
-    (*new_node)->right = current_parent;
-    (*new_node)->parent = current_parent->parent;
-
-    current_parent->parent = *new_node;
-    current_parent->left = new_left;
-    new_left->parent = current_parent;
-}
+static void left_rotate ( node_t** root,  node_t* node ) { /* node goes down to the left of its right child */
+    node_t* current_right = get_right(node);
+    node_t* new_right = get_left(current_right);
 
-static void left_right_rotate ( node_t** root, node_t* node ) {
-    left_rotate(root, node->right);
-    right_rotate(root, node);
-}
+    set_right(node, new_right);
+    if ( new_right != __sentinel ) set_parent(new_right, node);
 
-static void right_left_rotate ( node_t** root, node_t* node ) {
-    right_rotate(root, node->left);
-    left_rotate(root, node);
-}
+    transplant(root, node, current_right);
 
-static void swap_nodes ( node_t* inorder, node_t* node ) { /* inorder->left is __sentinel */
-    node_t* node_parent = node->parent;
-    node_t* node_left = node->left;
-    node_t* node_right = node->right;
-    node_t* inor_parent = inorder->parent;
-    node_t* inor_right = inorder->right;
-
-    bool color_node = get_color(node->header);
-    bool color_inor = get_color(inorder->header); 
-
-    node_t** new_node = node_parent != __sentinel ?
-                        (node_parent->left == node ? &node_parent->left : &node_parent->right) : &node;
-    
-    node_t** new_inorder = inor_parent != node ? 
-                            (inor_parent->left == inorder ? &inor_parent->left : &inor_parent->right) : &inorder;
-
-    /* perform swap by indirect linking */
-    (*new_node) = inorder;
-    (*new_inorder) = node; 
-
-    (*new_node)->parent = node_parent; 
-    (*new_node)->right = node_right == inorder ? *new_inorder : node_right;
-    (*new_node)->left = node_left;
-
-    (*new_inorder)->parent = inor_parent; 
-    (*new_inorder)->right = inor_right;
-    (*new_inorder)->left = __sentinel;
-
-    /* preserve color: if node was black, then, new_node is black  */
-    set_color(&(*new_inorder)->header, color_inor);
-    set_color(&(*new_node)->header, color_node); 
+    set_left(current_right, node);
+    set_parent(node, current_right);
 }
 
-static node_t* get_substitute ( node_t* node ) {
-    node_t* result = __sentinel; 
-    if ( node->left != __sentinel && node->right != __sentinel ) {
-        result = node->right;
-        while ( result->left != __sentinel ) result = result->left;
-    }
-    else if ( node->left != __sentinel || node->right != __sentinel ) 
-        result = node->left != __sentinel ? node->left : node->right; 
-    
-    return result; 
+static void right_rotate ( node_t** root, node_t* node ) { /* node goes down to the right of its left child */
+    node_t* current_left = get_left(node);
+    node_t* new_left = get_right(current_left);
+
+    set_left(node, new_left);
+    if ( new_left != __sentinel ) set_parent(new_left, node);
+
+    transplant(root, node, current_left);
+
+    set_right(current_left, node);
+    set_parent(node, current_left);
 }
 
-static bool fix_deletion ( node_t** root, node_t* result, bool black_token ) { /* bottom-up deletion */
-    node_t* current = result;
-    
-    while ( current != *root && black_token ) { /* push the black_token up the tree */
-        node_t* sibling = current->parent->left == current ? current->parent->right : current->parent->left;        
-        node_t* grandparent = current->parent->parent;
-
-        if ( current == __sentinel ) break;  /* reach the root */
-        
-        bool color_parent = get_color(current->parent->header);
-        bool color_sibling = get_color(sibling->header);
-        bool color_current = get_color(current->header); 
-        ChildKind current_kind = get_child_kind(current);
-
-        if ( get_color(current->header) ) { /* found a red node */
-            set_color(&current->header, __black);
-            black_token = !black_token; 
-        }
-        else if ( get_color(sibling->header) ) { /* double black violations and red sibling */
-            set_color(&(current->parent)->header, __red);
-            set_color(&sibling->header, __black); 
-            current_kind == LEFT ? left_rotate(root, current->parent) : right_rotate(root, current->parent); 
-            continue; 
+static bool fix_deletion ( node_t** root, node_t* current, node_t* parent ) { /* push the black_token up the tree */
+    while ( current != *root && !get_color(current->header) ) { /* a __sentinel current has a real sibling */
+        ChildKind current_kind = get_left(parent) == current ? LEFT : RIGHT;
+        node_t* sibling = current_kind == LEFT ? get_right(parent) : get_left(parent);
+
+        if ( get_color(sibling->header) ) { /* red sibling: rotate it up to get a black one */
+            set_color(&sibling->header, __black);
+            set_color(&parent->header, __red);
+            current_kind == LEFT ? left_rotate(root, parent) : right_rotate(root, parent);
+            sibling = current_kind == LEFT ? get_right(parent) : get_left(parent);
         }
-        else if ( get_color(sibling->left->header) || get_color(sibling->right->header) ) { /* double black violatons and black sibling */
-            node_t** near = current_kind == LEFT ? &sibling->left : &sibling->right;
-            node_t** far = current_kind == LEFT ? &sibling->right : &sibling->left;  
-
-            if ( !get_color((*far)->header) ) 
-                current_kind == LEFT ? left_rotate(root, sibling) : right_rotate(root, sibling); 
-            
-            current_kind == LEFT ? right_rotate(root, current->parent) : left_rotate(root, current->parent); 
-            black_token = !black_token;       
+
+        node_t* near = current_kind == LEFT ? get_left(sibling) : get_right(sibling);
+        node_t* far = current_kind == LEFT ? get_right(sibling) : get_left(sibling);
+
+        if ( !get_color(near->header) && !get_color(far->header) ) { /* black sibling and two black nephews */
+            set_color(&sibling->header, __red);
+            current = parent;
+            parent = get_parent(current);
+            continue;
         }
-        else { /* black sibling and two black nephews */
-             set_color(&sibling->header, __red);
-             if ( get_color(sibling->parent->header) ) {
-                set_color(&(sibling->parent)->header, __black);
-                black_token = !black_token;
-            } 
-            current = sibling->parent;
-            continue; 
+
+        if ( !get_color(far->header) ) { /* red near nephew: turn it into the far one */
+            set_color(&near->header, __black);
+            set_color(&sibling->header, __red);
+            current_kind == LEFT ? right_rotate(root, sibling) : left_rotate(root, sibling);
+            sibling = current_kind == LEFT ? get_right(parent) : get_left(parent);
+            far = current_kind == LEFT ? get_right(sibling) : get_left(sibling);
         }
-        
-        current = grandparent; 
-    } 
-      
+
+        /* red far nephew: one rotation absorbs the black_token */
+        set_color(&sibling->header, get_color(parent->header));
+        set_color(&parent->header, __black);
+        set_color(&far->header, __black);
+        current_kind == LEFT ? left_rotate(root, parent) : right_rotate(root, parent);
+        current = *root;
+    }
+
+    if ( current != __sentinel ) set_color(&current->header, __black);
     return true;
 }
 
-static bool fix_subtree ( node_t** root, node_t* current_subtree ) { /* fix insertion before inserting */
-    set_color(&current_subtree->header, __red);
-    set_color(&current_subtree->left->header, __black);
-    set_color(&current_subtree->right->header, __black);
+static bool fix_subtree ( node_t** root, node_t* current_subtree ) { /* fix red-red violations after insertion */
+    node_t* current = current_subtree;
 
-    node_t* parent = current_subtree->parent;
-    node_t* grandpa = parent->parent; 
+    while ( get_color(get_parent(current)->header) ) { /* a red parent is never the root */
+        node_t* parent = get_parent(current);
+        node_t* grandpa = get_parent(parent);
+        ChildKind parent_kind = get_child_kind(parent);
+        node_t* uncle = parent_kind == LEFT ? get_right(grandpa) : get_left(grandpa);
 
-    if ( get_color(current_subtree->parent->header) ) { /* perform fixes */
-        ChildKind current_kind = get_child_kind(current_subtree);
-        ChildKind parent_kind = get_child_kind(current_subtree->parent);
-
-        if ( current_kind == parent_kind ) { /* straight line */
+        if ( get_color(uncle->header) ) { /* red uncle: recolor and go up */
             set_color(&parent->header, __black);
-            set_color(&grandpa->header, __red); 
-            current_kind == LEFT ? right_rotate(root, current_subtree) : left_rotate(root, current_subtree);
-        }
-        else { /* zig-zag */
+            set_color(&uncle->header, __black);
             set_color(&grandpa->header, __red);
-            set_color(&current_subtree->header, __black);  
-            current_kind == LEFT ? right_left_rotate(root, current_subtree) : left_right_rotate(root, current_subtree);  
+            current = grandpa;
+            continue;
         }
+
+        if ( get_child_kind(current) != parent_kind ) { /* zig-zag: make it a straight line */
+            current = parent;
+            parent_kind == LEFT ? left_rotate(root, current) : right_rotate(root, current);
+            parent = get_parent(current);
+        }
+
+        /* straight line */
+        set_color(&parent->header, __black);
+        set_color(&grandpa->header, __red);
+        parent_kind == LEFT ? right_rotate(root, grandpa) : left_rotate(root, grandpa);
     }
 
-    set_color(&(*root)->header, __black); 
+    set_color(&(*root)->header, __black);
     return true;
 }
@@ -0,0 +1,17 @@
+#include "../include/shard.h"
+#include "../include/base.h"
+#include <stdatomic.h>
+
+static _Atomic u64 n_shards = 0;
+static _Thread_local u64 current_shard = 0; /* index + 1, 0 until claimed */
+
+u64 get_shard_index ( void ) {
+    if ( !current_shard )
+        current_shard = atomic_fetch_add_explicit(&n_shards, 1, memory_order_relaxed) % MAX_SHARDS + 1;
+    return current_shard - 1;
+}
+
+u64 get_used_shards ( void ) {
+    u64 used = atomic_load_explicit(&n_shards, memory_order_relaxed);
+    return used < MAX_SHARDS ? used : MAX_SHARDS;
+}
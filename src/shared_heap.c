@@ -0,0 +1,231 @@
+#define _GNU_SOURCE /* memfd_create */
+#include "../include/shared_heap.h"
+#include "../include/allocator.h"
+#include "../include/base.h"
+#include "../include/rb_tree.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HEAP_START ALIGN(sizeof(region_t)) /* prologue offset, first block header right after it */
+#define MAGIC 0x6d79736861726564ULL /* "myshared" */
+
+typedef struct Region { /* lives at offset 0 of the mapping, shared by everyone */
+    u64 magic;
+    u64 size;              /* bytes in the mapping */
+    pthread_mutex_t lock;  /* robust and process-shared */
+    u64 root;              /* free tree root, offset from the region base, 0 when empty */
+} region_t;
+
+struct SharedHeap {
+    region_t* region;
+    int fd;
+};
+
+static shared_heap_t* new_handle ( region_t* region, int fd );
+static bool lock_region ( region_t* region );
+static node_t* load_root ( region_t* region );
+static void store_root ( region_t* region, node_t* root );
+static node_t* first_node ( region_t* region );
+static void rebuild_tree ( region_t* region );
+
+shared_heap_t* shared_heap_create ( const char* name, u64 size ) {
+    int fd = memfd_create(name, 0);
+    if ( fd < 0 ) {
+        print_error("memfd_create failed\n");
+        return NULL;
+    }
+
+    shared_heap_t* heap = shared_heap_format(fd, size);
+    if ( !heap ) close(fd);
+    return heap;
+}
+
+shared_heap_t* shared_heap_format ( int fd, u64 size ) {
+    u64 smallest = HEAP_START + FENCES + 2 * sizeof(header_t) + MIN_SIZE;
+    size = PAGES( size < smallest ? smallest : size );
+
+    if ( ftruncate(fd, size) ) {
+        print_error("Cannot resize the shared heap file\n");
+        return NULL;
+    }
+
+    region_t* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( region == MAP_FAILED ) {
+        print_error("mmap failed to map the shared heap\n");
+        return NULL;
+    }
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&region->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    region->size = size;
+    *(header_t *)((u8 *)region + HEAP_START) = 0; /* prologue: in-use, size 0 */
+    *(header_t *)((u8 *)region + size - sizeof(header_t)) = 0; /* epilogue */
+
+    node_t* root = __sentinel;
+    node_t* node = init_node(first_node(region), size - HEAP_START - FENCES - 2 * sizeof(header_t), __black, __free);
+    insert(&root, node);
+    store_root(region, root);
+
+    region->magic = MAGIC; /* last, attach refuses half formatted regions */
+
+    shared_heap_t* heap = new_handle(region, fd);
+    if ( !heap ) munmap(region, size);
+    return heap;
+}
+
+shared_heap_t* shared_heap_attach ( int fd ) {
+    struct stat file;
+    if ( fstat(fd, &file) || (u64)file.st_size < HEAP_START ) {
+        print_error("Not a shared heap\n");
+        return NULL;
+    }
+
+    region_t* region = mmap(NULL, file.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( region == MAP_FAILED ) {
+        print_error("mmap failed to map the shared heap\n");
+        return NULL;
+    }
+
+    if ( region->magic != MAGIC || region->size != (u64)file.st_size ) {
+        print_error("Not a shared heap\n");
+        munmap(region, file.st_size);
+        return NULL;
+    }
+
+    shared_heap_t* heap = new_handle(region, fd);
+    if ( !heap ) munmap(region, file.st_size);
+    return heap;
+}
+
+void shared_heap_detach ( shared_heap_t* heap ) {
+    if ( !heap ) return;
+    munmap(heap->region, heap->region->size);
+    deallocate(heap);
+}
+
+int shared_heap_fd ( shared_heap_t* heap ) {
+    return heap->fd;
+}
+
+void* shared_allocate ( shared_heap_t* heap, u64 size ) {
+    if ( size > heap->region->size ) return NULL;
+    size = size < MIN_SIZE ? MIN_SIZE : ALIGN(size);
+
+    if ( !lock_region(heap->region) ) return NULL;
+
+    node_t* root = load_root(heap->region);
+    node_t* node = search(root, size); /* best fit */
+    if ( node != __sentinel ) {
+        delete(&root, node);
+        split_node(&root, node, size);
+        store_root(heap->region, root);
+    }
+
+    pthread_mutex_unlock(&heap->region->lock);
+    return node != __sentinel ? (u8 *)node + sizeof(header_t) : NULL; /* full */
+}
+
+void shared_deallocate ( shared_heap_t* heap, void* ptr ) {
+    if ( !ptr ) return;
+
+    u8* start = (u8 *)first_node(heap->region) + sizeof(header_t);
+    u8* end = (u8 *)heap->region + heap->region->size;
+    if ( (u8 *)ptr < start || (u8 *)ptr >= end ) {
+        print_error("Pointer does not belong to the shared heap\n");
+        return;
+    }
+
+    if ( !lock_region(heap->region) ) return;
+
+    node_t* node = get_node(ptr);
+    if ( get_status(node->header) ) print_error("Double free operation\n");
+    else {
+        node_t* root = load_root(heap->region);
+        coalesce(&root, node);
+        store_root(heap->region, root);
+    }
+
+    pthread_mutex_unlock(&heap->region->lock);
+}
+
+u64 shared_offset ( shared_heap_t* heap, void* ptr ) {
+    return (u8 *)ptr - (u8 *)heap->region;
+}
+
+void* shared_pointer ( shared_heap_t* heap, u64 offset ) {
+    return offset && offset < heap->region->size ? (u8 *)heap->region + offset : NULL;
+}
+
+static shared_heap_t* new_handle ( region_t* region, int fd ) {
+    shared_heap_t* heap = allocate(sizeof(shared_heap_t));
+    if ( !heap ) return NULL;
+    heap->region = region;
+    heap->fd = fd;
+    return heap;
+}
+
+static bool lock_region ( region_t* region ) {
+    int error = pthread_mutex_lock(&region->lock);
+
+    if ( error == EOWNERDEAD ) { /* the owner died mid operation, boundary tags are the truth */
+        rebuild_tree(region);
+        pthread_mutex_consistent(&region->lock);
+        return true;
+    }
+
+    if ( error ) {
+        print_error("Cannot lock the shared heap\n");
+        return false;
+    }
+    return true;
+}
+
+static node_t* load_root ( region_t* region ) {
+    return region->root ? (node_t *)((u8 *)region + region->root) : __sentinel;
+}
+
+static void store_root ( region_t* region, node_t* root ) {
+    region->root = root == __sentinel ? 0 : (u8 *)root - (u8 *)region;
+}
+
+static node_t* first_node ( region_t* region ) {
+    return (node_t *)((u8 *)region + HEAP_START + sizeof(header_t));
+}
+
+static void rebuild_tree ( region_t* region ) { /* walks every block, merging and inserting the free ones */
+    node_t* root = __sentinel;
+    node_t* run = __sentinel; /* free blocks merged so far */
+    u8* epilogue = (u8 *)region + region->size - sizeof(header_t);
+
+    for ( node_t* node = first_node(region); (u8 *)node < epilogue; node = get_next_node(node) ) {
+        u64 size = get_size(node->header);
+        if ( size < MIN_SIZE || size % ALIGNMENT || (u8 *)node + 2 * sizeof(header_t) + size > epilogue ) {
+            print_error("Corrupted shared heap, the blocks past this point are lost\n");
+            break;
+        }
+        /*
+            split and merge write a block's header before anything that
+            depends on it, so a header is the truth and the footer may lag
+            behind: a dead owner leaves either the old blocks or the new ones.
+         */
+        set_footer(node);
+
+        if ( !get_status(node->header) ) {
+            if ( run != __sentinel ) insert(&root, run);
+            run = __sentinel;
+            continue;
+        }
+        run = run == __sentinel ? init_node(node, size, __red, __free) : merge_nodes(run, node);
+    }
+    if ( run != __sentinel ) insert(&root, run);
+
+    store_root(region, root);
+}
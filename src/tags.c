@@ -0,0 +1,53 @@
+#include "../include/tags.h"
+#include "../include/allocator.h"
+#include "../include/base.h"
+#include "../include/rb_tree.h"
+#include "../include/shard.h"
+#include <stdatomic.h>
+
+typedef struct Shard { /* written by its own thread only, unless shards are shared */
+    _Alignas(CACHE_LINE) _Atomic i64 live_bytes[__max_tags];
+    _Atomic u64 allocations[__max_tags];
+    _Atomic u64 deallocations[__max_tags];
+} shard_t;
+
+static shard_t shards[ MAX_SHARDS ];
+
+void* allocate_tagged ( u64 size, u8 tag ) {
+    if ( tag >= __max_tags ) {
+        print_error("Tag out of range\n");
+        return NULL;
+    }
+
+    void* ptr = allocate( size );
+    if ( !ptr || !tag ) return ptr;
+
+    node_t* node = get_node(ptr);
+    set_tag(&node->header, tag);
+    count_allocation(tag, get_size(node->header));
+    return ptr;
+}
+
+void get_tag_stats ( u8 tag, tag_stats_t* stats ) { /* sums every shard, a snapshot under concurrent use */
+    stats->live_bytes = 0;
+    stats->allocations = stats->deallocations = 0;
+    if ( tag >= __max_tags ) return;
+
+    for ( u64 i = 0; i < get_used_shards(); i++ ) {
+        stats->live_bytes += atomic_load_explicit(&shards[i].live_bytes[tag], memory_order_relaxed);
+        stats->allocations += atomic_load_explicit(&shards[i].allocations[tag], memory_order_relaxed);
+        stats->deallocations += atomic_load_explicit(&shards[i].deallocations[tag], memory_order_relaxed);
+    }
+}
+
+void count_allocation ( u8 tag, u64 bytes ) {
+    shard_t* shard = &shards[ get_shard_index() ];
+    atomic_fetch_add_explicit(&shard->live_bytes[tag], bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->allocations[tag], 1, memory_order_relaxed);
+}
+
+void count_deallocation ( u8 tag, u64 bytes ) { /* may land on another thread's tag, shards sum up anyway */
+    shard_t* shard = &shards[ get_shard_index() ];
+    atomic_fetch_sub_explicit(&shard->live_bytes[tag], bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->deallocations[tag], 1, memory_order_relaxed);
+}
@@ -0,0 +1,470 @@
+#include "../include/test.h"
+#include "../include/allocator.h"
+#include "../include/latency.h"
+#include "../include/tags.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define N_BLOCKS 256
+
+static void* blocks[N_BLOCKS] = { 0 };
+static u64 sizes[N_BLOCKS] = { 0 };
+
+/* helpers */
+static bool init_side ( void );
+static void fill_block ( void* ptr, u64 size, u8 seed );
+static bool check_block ( void* ptr, u64 size, u8 seed );
+static bool report ( const char* name, bool result );
+static u64 resident_after_purge ( Hint short_hint, Hint long_hint, bool* result );
+
+bool test_malloc ( void ) {
+    puts("Testing allocate");
+    bool result = true;
+
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) {
+        sizes[i] = (i * 37) % 3000; /* includes 0 */
+        blocks[i] = allocate(sizes[i]);
+        if ( !blocks[i] || (uintptr_t)blocks[i] % 16 ) {
+            fprintf(stderr, "Block %llu of size %llu is NULL or misaligned\n", i, sizes[i]);
+            result = false;
+            continue;
+        }
+        fill_block(blocks[i], sizes[i], i);
+    }
+
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) /* every block survived its neighbours being written */
+        if ( blocks[i] && !check_block(blocks[i], sizes[i], i) ) {
+            fprintf(stderr, "Block %llu was overwritten\n", i);
+            result = false;
+        }
+
+    if ( allocate((u64) 1 << 62) ) {
+        fprintf(stderr, "Absurd request did not fail\n");
+        result = false;
+    }
+
+    return report("Allocate", result);
+}
+
+bool test_realloc ( void ) {
+    puts("Testing reallocate");
+    bool result = true;
+
+    for ( u64 i = 0; i < N_BLOCKS; i += 2 ) { /* grow */
+        void* ptr = reallocate(blocks[i], sizes[i] * 2 + 100);
+        if ( !ptr || !check_block(ptr, sizes[i], i) ) {
+            fprintf(stderr, "Growing block %llu lost its content\n", i);
+            result = false;
+            continue;
+        }
+        blocks[i] = ptr;
+        sizes[i] = sizes[i] * 2 + 100;
+        fill_block(blocks[i], sizes[i], i);
+    }
+
+    for ( u64 i = 1; i < N_BLOCKS; i += 2 ) { /* shrink keeps the block */
+        if ( reallocate(blocks[i], sizes[i] / 2) != blocks[i] ) {
+            fprintf(stderr, "Shrinking block %llu moved it\n", i);
+            result = false;
+        }
+    }
+
+    void* ptr = reallocate(NULL, 64);
+    if ( !ptr ) {
+        fprintf(stderr, "reallocate(NULL) did not allocate\n");
+        result = false;
+    }
+    deallocate(ptr);
+
+    ptr = allocate(64);
+    fill_block(ptr, 64, 5);
+    if ( reallocate(ptr, UINT64_MAX) || !check_block(ptr, 64, 5) ) { /* must not wrap around to a tiny block */
+        fprintf(stderr, "Huge reallocate did not fail cleanly\n");
+        result = false;
+    }
+    deallocate(ptr);
+
+    u64 actual = 0; /* growing into the slack does not move the block */
+    ptr = allocate_at_least(100, &actual);
+    if ( !ptr || actual < 100 || actual != usable_size(ptr) || reallocate(ptr, actual) != ptr ) {
+        fprintf(stderr, "allocate_at_least reported %llu usable bytes\n", actual);
+        result = false;
+    }
+    fill_block(ptr, actual, 3);
+    deallocate(ptr);
+    if ( usable_size(ptr) || usable_size(&actual) ) {
+        fprintf(stderr, "Freed or foreign pointer has a usable size\n");
+        result = false;
+    }
+
+    return report("Reallocate", result);
+}
+
+bool test_free ( void ) {
+    puts("Testing deallocate");
+    bool result = true;
+
+    deallocate(blocks[N_BLOCKS / 2]); /* best fit hands the same hole back */
+    void* ptr = allocate(sizes[N_BLOCKS / 2]);
+    if ( ptr != blocks[N_BLOCKS / 2] ) {
+        fprintf(stderr, "Freed block was not reused\n");
+        result = false;
+    }
+    blocks[N_BLOCKS / 2] = ptr;
+
+    void* small = allocate(48); /* quick lists hand a small block straight back */
+    deallocate(small);
+    if ( allocate(48) != small ) {
+        fprintf(stderr, "Deferred block was not reused\n");
+        result = false;
+    }
+    deallocate(small);
+
+    for ( u64 i = 0; i < N_BLOCKS; i += 2 ) deallocate(blocks[i]); /* leave holes first */
+    for ( u64 i = 1; i < N_BLOCKS; i += 2 ) deallocate(blocks[i]);
+    deallocate(NULL);
+
+    u64 foreign[8] = { 0 }; /* the page map turns these away before any header is read */
+    deallocate(&foreign[4]);
+    void* from_libc = malloc(64);
+    deallocate(from_libc);
+    free(from_libc);
+
+    stats_t stats = { 0 };
+    get_stats(&stats);
+    /* fully coalesced: one free node per chunk, each one short of the fences and its own tags */
+    if ( stats.free_bytes + stats.free_blocks * 4 * sizeof(u64) != stats.mapped_bytes ) {
+        fprintf(stderr, "Heap not coalesced: %llu free bytes in %llu nodes out of %llu mapped\n",
+                stats.free_bytes, stats.free_blocks, stats.mapped_bytes);
+        result = false;
+    }
+
+    return report("Deallocate", result);
+}
+
+bool test_arenas ( void ) {
+    puts("Testing hinted arenas");
+    bool result = true;
+
+    void* long_lived = allocate_hinted(64, LONG_LIVED); /* a freed block goes back to its own arena */
+    deallocate(long_lived);
+    void* ptr = allocate(64);
+    if ( ptr == long_lived ) {
+        fprintf(stderr, "Hinted block leaked into the default heap\n");
+        result = false;
+    }
+    deallocate(ptr);
+
+    /* same interleaved workload, as a server would run it: only with hints can purge free the short-lived pages */
+    u64 unhinted = resident_after_purge(NO_HINT, NO_HINT, &result);
+    u64 hinted = resident_after_purge(SHORT_LIVED, LONG_LIVED, &result);
+    if ( hinted * 4 > unhinted ) {
+        fprintf(stderr, "Long-lived blocks pin short-lived pages: %llu of %d resident hinted, %llu unhinted\n",
+                hinted, N_BLOCKS, unhinted);
+        result = false;
+    }
+
+    if ( allocate_hinted(64, N_HINTS) ) {
+        fprintf(stderr, "Unknown hint did not fail\n");
+        result = false;
+    }
+
+    return report("Hinted arenas", result);
+}
+
+bool test_init ( void ) { /* flags are process wide, so the reserve lives in a child */
+    puts("Testing allocator_init");
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if ( pid == 0 ) _exit( init_side() ? 0 : 1 );
+
+    int status = 0;
+    bool result = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && !WEXITSTATUS(status);
+    return report("allocator_init", result);
+}
+
+static bool init_side ( void ) {
+    stats_t before = { 0 };
+    get_stats(&before);
+    if ( !allocator_init(8 << 20, INIT_PREFAULT | INIT_NO_GROW) ) {
+        fprintf(stderr, "allocator_init failed\n");
+        return false;
+    }
+
+    stats_t after = { 0 };
+    get_stats(&after);
+    if ( after.mapped_bytes - before.mapped_bytes < (8 << 20) || after.largest_free < (8 << 20) ) {
+        fprintf(stderr, "Reserve was not seeded into the free tree\n");
+        return false;
+    }
+
+    struct rusage usage = { 0 };
+    getrusage(RUSAGE_SELF, &usage);
+    long faults = usage.ru_minflt;
+    u8* control = mmap(NULL, 4 << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0); /* what the reserve costs without INIT_PREFAULT */
+    if ( control == MAP_FAILED ) return false;
+    madvise(control, 4 << 20, MADV_NOHUGEPAGE);
+    for ( u64 i = 0; i < 64; i++ ) memset(control + (i << 16), 0xab, 64 << 10);
+    getrusage(RUSAGE_SELF, &usage);
+    long control_faults = usage.ru_minflt - faults;
+    munmap(control, 4 << 20);
+
+    getrusage(RUSAGE_SELF, &usage);
+    faults = usage.ru_minflt;
+
+    void* ptrs[64] = { 0 };
+    for ( u64 i = 0; i < 64; i++ ) { /* 4 MB out of the reserve, every page written */
+        ptrs[i] = allocate(64 << 10);
+        if ( !ptrs[i] ) {
+            fprintf(stderr, "Allocation inside the reserve failed\n");
+            return false;
+        }
+        memset(ptrs[i], 0xab, 64 << 10);
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    if ( usage.ru_minflt - faults > control_faults / 2 ) { /* blocks in chunks inherited from the parent still copy on write */
+        fprintf(stderr, "Prefaulted reserve took %ld page faults, %ld without prefaulting\n", usage.ru_minflt - faults, control_faults);
+        return false;
+    }
+
+    void* big = allocate(2 << 20); /* over the mmap threshold, still out of the reserve */
+    void* hinted = allocate_hinted(2 << 20, SHORT_LIVED); /* hinted arenas are not seeded, the reserve is */
+    if ( !big || !hinted ) {
+        fprintf(stderr, "Big or hinted allocation could not use the reserve\n");
+        return false;
+    }
+    memset(big, 0xcd, 2 << 20);
+    memset(hinted, 0xef, 2 << 20);
+
+    get_stats(&before);
+    if ( before.mapped_bytes != after.mapped_bytes ) {
+        fprintf(stderr, "Allocations inside the reserve called mmap\n");
+        return false;
+    }
+    deallocate(big);
+    deallocate(hinted);
+
+    if ( allocate(16 << 20) ) { /* INIT_NO_GROW */
+        fprintf(stderr, "Heap grew past its reserve\n");
+        return false;
+    }
+
+    for ( u64 i = 0; i < 64; i++ ) deallocate(ptrs[i]);
+    return true;
+}
+
+bool test_options ( void ) {
+    puts("Testing allocator options");
+    bool result = true;
+    i64 threshold = allocator_get_option(OPTION_MMAP_THRESHOLD);
+    i64 quick_max = allocator_get_option(OPTION_QUICK_MAX);
+
+    if ( !allocator_parse_options("mmap_threshold=64k,quick_max=256") ||
+         allocator_get_option(OPTION_MMAP_THRESHOLD) != 64 << 10 || allocator_get_option(OPTION_QUICK_MAX) != 256 ) {
+        fprintf(stderr, "Options were not parsed\n");
+        result = false;
+    }
+    if ( !allocator_parse_options("mmap_threshold=010k,quick_max=0x100") ||
+         allocator_get_option(OPTION_MMAP_THRESHOLD) != 10 << 10 || allocator_get_option(OPTION_QUICK_MAX) != 256 ) {
+        fprintf(stderr, "Leading zeros were not read as decimal\n");
+        result = false;
+    }
+    allocator_parse_options("mmap_threshold=64k");
+
+    stats_t before = { 0 };
+    stats_t after = { 0 };
+    get_stats(&before);
+    void* ptr = allocate(128 << 10); /* over the threshold: a mapping of its own */
+    get_stats(&after);
+    if ( after.mapped_bytes - before.mapped_bytes < 128 << 10 ) {
+        fprintf(stderr, "Big block did not get its own mapping\n");
+        result = false;
+    }
+    fill_block(ptr, 128 << 10, 7);
+    deallocate((u8 *)ptr + 8192); /* interior pointer: user data must not be read as a header */
+    if ( usable_size((u8 *)ptr + 8192) || reallocate((u8 *)ptr + 8192, 1 << 20) || !check_block(ptr, 128 << 10, 7) ) {
+        fprintf(stderr, "Interior pointer into a mapped block was accepted\n");
+        result = false;
+    }
+    deallocate(ptr);
+    get_stats(&after);
+    if ( after.mapped_bytes != before.mapped_bytes ) {
+        fprintf(stderr, "Big block was not unmapped\n");
+        result = false;
+    }
+
+    if ( allocator_parse_options("quick_max=1k") || allocator_parse_options("no_such_option=1") ||
+         allocator_parse_options("arenas=two") || allocator_set_option(OPTION_ARENAS, 0) ||
+         allocator_parse_options("chunk_size=99999999999g") || allocator_parse_options("mmap_threshold=99999999999999999999") ||
+         allocator_parse_options("mmap_threshold=-1k") ) {
+        fprintf(stderr, "Invalid options were accepted\n");
+        result = false;
+    }
+
+    allocator_set_option(OPTION_MMAP_THRESHOLD, threshold);
+    allocator_set_option(OPTION_QUICK_MAX, quick_max);
+    return report("Options", result);
+}
+
+bool test_tags ( void ) {
+    puts("Testing tagged allocations");
+    bool result = true;
+    tag_stats_t stats = { 0 };
+
+    void* small = allocate_tagged(100, 1); /* rounded up to 112 */
+    void* big = allocate_tagged(2 << 20, 2); /* over the mmap threshold */
+    get_tag_stats(1, &stats);
+    if ( stats.live_bytes != 112 || stats.allocations != 1 ) {
+        fprintf(stderr, "Small tagged block was not accounted\n");
+        result = false;
+    }
+    get_tag_stats(2, &stats);
+    if ( stats.live_bytes < 2 << 20 ) {
+        fprintf(stderr, "Mapped tagged block was not accounted\n");
+        result = false;
+    }
+
+    small = reallocate(small, 1000); /* the tag moves with the data */
+    deallocate(big);
+    get_tag_stats(1, &stats);
+    if ( stats.live_bytes != 1008 || stats.allocations != 2 || stats.deallocations != 1 ) {
+        fprintf(stderr, "Reallocated tagged block was not accounted\n");
+        result = false;
+    }
+    get_tag_stats(2, &stats);
+    if ( stats.live_bytes || stats.deallocations != 1 ) {
+        fprintf(stderr, "Freed mapped block is still accounted\n");
+        result = false;
+    }
+
+    deallocate(small);
+    void* untagged = allocate(1000); /* the same block, back from the quick list or the tree */
+    deallocate(untagged);
+    get_tag_stats(1, &stats);
+    if ( stats.live_bytes || stats.deallocations != 2 ) {
+        fprintf(stderr, "Tag outlived its block\n");
+        result = false;
+    }
+
+    if ( allocate_tagged(64, __max_tags) ) {
+        fprintf(stderr, "Unknown tag did not fail\n");
+        result = false;
+    }
+
+    return report("Tagged allocations", result);
+}
+
+bool test_latency ( void ) {
+    puts("Testing latency histograms");
+    bool result = true;
+
+    for ( u32 b = 1; b < LATENCY_BUCKETS; b++ ) {
+        if ( latency_bucket_floor(b) <= latency_bucket_floor(b - 1) ) {
+            fprintf(stderr, "Latency buckets are not increasing at %lu\n", b);
+            result = false;
+            break;
+        }
+    }
+
+    static latency_stats_t before, after; /* a few KB each */
+    if ( !get_latency_stats(LATENCY_ALLOCATE, &before) ) {
+        puts("Latency histograms are compiled out");
+        return report("Latency histograms", result);
+    }
+
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) blocks[i] = allocate(64);
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) deallocate(blocks[i]);
+    void* ptr = allocate(64); /* straight from a quick list */
+    deallocate(ptr);
+
+    get_latency_stats(LATENCY_ALLOCATE, &after);
+    if ( after.count - before.count != N_BLOCKS + 1 || latency_percentile(&after, 0.5) > latency_percentile(&after, 0.999) ) {
+        fprintf(stderr, "Allocations were not recorded\n");
+        result = false;
+    }
+    get_latency_stats(LATENCY_QUICK_HIT, &after);
+    if ( !after.count ) {
+        fprintf(stderr, "Quick list hits were not recorded\n");
+        result = false;
+    }
+    get_latency_stats(LATENCY_DEALLOCATE, &after);
+    if ( after.count < N_BLOCKS + 1 ) {
+        fprintf(stderr, "Deallocations were not recorded\n");
+        result = false;
+    }
+
+    u8* run[4] = { allocate(4096), allocate(4096), allocate(4096), allocate(4096) }; /* too big to defer */
+    static latency_stats_t inserts;
+    get_latency_stats(LATENCY_TREE_INSERT, &before);
+    get_latency_stats(LATENCY_TREE_DELETE, &after);
+    u64 deletes = after.count;
+    deallocate(run[2]); /* in-use neighbours: one insert */
+    deallocate(run[1]); /* merges with run[2]: one delete, one insert */
+    get_latency_stats(LATENCY_TREE_INSERT, &inserts);
+    get_latency_stats(LATENCY_TREE_DELETE, &after);
+    if ( inserts.count - before.count != 2 || after.count - deletes != 1 ) {
+        fprintf(stderr, "Coalescing recorded %llu inserts and %llu deletes\n", inserts.count - before.count, after.count - deletes);
+        result = false;
+    }
+    deallocate(run[0]);
+    deallocate(run[3]);
+
+    return report("Latency histograms", result);
+}
+
+static u64 resident_after_purge ( Hint short_hint, Hint long_hint, bool* result ) { /* short-lived pages still in RAM */
+    void* short_lived[N_BLOCKS] = { 0 };
+    void* long_lived[N_BLOCKS] = { 0 };
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) {
+        short_lived[i] = allocate_hinted(4096, short_hint);
+        long_lived[i] = allocate_hinted(64, long_hint);
+        fill_block(short_lived[i], 4096, i); /* faults its pages in */
+        fill_block(long_lived[i], 64, i);
+    }
+
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) deallocate(short_lived[i]);
+    purge();
+
+    u64 resident = 0;
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) { /* the page under the middle of each freed block */
+        unsigned char in_core = 0;
+        void* page = (void *)(((uintptr_t)short_lived[i] + 2048) & ~(uintptr_t)4095);
+        if ( !mincore(page, 4096, &in_core) && (in_core & 1) ) resident++;
+    }
+
+    for ( u64 i = 0; i < N_BLOCKS; i++ ) {
+        if ( !check_block(long_lived[i], 64, i) ) {
+            fprintf(stderr, "Long-lived block %llu was overwritten\n", i);
+            *result = false;
+        }
+        deallocate(long_lived[i]);
+    }
+    return resident;
+}
+
+static void fill_block ( void* ptr, u64 size, u8 seed ) {
+    u8* bytes = ptr;
+    for ( u64 i = 0; i < size; i++ ) bytes[i] = seed + i;
+}
+
+static bool check_block ( void* ptr, u64 size, u8 seed ) {
+    u8* bytes = ptr;
+    for ( u64 i = 0; i < size; i++ ) if ( bytes[i] != (u8)(seed + i) ) return false;
+    return true;
+}
+
+static bool report ( const char* name, bool result ) {
+    fprintf( !result ? stderr : stdout, "%s test %s\n", name, !result ? "failed" : "passed" );
+    return result;
+}
@@ -0,0 +1,219 @@
+#include "../include/test.h"
+#include "../include/allocator.h"
+#include "../include/rand.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+    Fragmentation harness: the same seeded workload is replayed on top of
+    allocate/deallocate and on top of glibc, each one in its own process so
+    RSS belongs to a single allocator. Every phase reports live bytes, RSS
+    and their ratio; ours also reports the largest block it can serve.
+
+    RAMP-UP -> RANDOM FREES -> STEADY CHURN (bigger sizes) -> MIXED SIZES -> TEARDOWN
+ */
+
+#define SLOTS 20000
+#define CHURN_OPS 200000
+#define SAMPLE_EVERY 50000
+#define SEED 0x2545F4914F6CDD1DULL
+#define MAX_RATIO 4.0 /* RSS / live bytes above this is a fragmentation blowup */
+
+typedef enum Distribution {
+    SMALL,    /* 16 - 512 */
+    SHIFTED,  /* 256 - 4096, mostly too big for the holes SMALL leaves */
+    MIXED     /* SMALL with some 4K - 64K blocks */
+} Distribution;
+
+typedef struct Backend {
+    const char* name;
+    void* (*alloc) ( u64 size );
+    void (*release) ( void* ptr );
+    bool has_stats;
+} backend_t;
+
+typedef struct Run {
+    const backend_t* backend;
+    pcg32_random_t rng;
+    void* ptrs[SLOTS];
+    u64 sizes[SLOTS];
+    u64 live_bytes;
+    u64 base_rss;
+    double peak_ratio;
+    bool corrupted;
+} run_t;
+
+/* helpers */
+static void* libc_alloc ( u64 size );
+static void libc_release ( void* ptr );
+static bool run_backend ( const backend_t* backend );
+static bool run_workload ( run_t* run );
+static u64 draw_size ( run_t* run, Distribution distribution );
+static void alloc_slot ( run_t* run, u64 slot, Distribution distribution );
+static void free_slot ( run_t* run, u64 slot );
+static void churn ( run_t* run, const char* phase, Distribution distribution );
+static void sample ( run_t* run, const char* phase, u64 ops );
+static u64 get_rss ( void );
+
+static const backend_t backends[] = {
+    { "allocator", allocate, deallocate, true },
+    { "glibc", libc_alloc, libc_release, false },
+};
+
+bool test_fragmentation ( void ) {
+    puts("Testing fragmentation");
+    bool result = true;
+    for ( u64 i = 0; i < sizeof(backends) / sizeof(backends[0]); i++ ) {
+        bool passed = run_backend(&backends[i]);
+        if ( backends[i].has_stats ) result = result && passed; /* glibc is only the baseline */
+    }
+    fprintf( !result ? stderr : stdout, !result ? "Fragmentation test failed\n" : "Fragmentation test passed\n" );
+    return result;
+}
+
+static bool run_backend ( const backend_t* backend ) { /* isolate every allocator in a child process */
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if ( pid < 0 ) {
+        fprintf(stderr, "fork failed\n");
+        return false;
+    }
+    if ( pid == 0 ) {
+        static run_t run; /* too big for the stack */
+        run.backend = backend;
+        _exit( run_workload(&run) ? 0 : 1 );
+    }
+
+    int status = 0;
+    if ( waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ) {
+        fprintf(stderr, "%s: workload crashed\n", backend->name);
+        return false;
+    }
+    return WEXITSTATUS(status) == 0;
+}
+
+static bool run_workload ( run_t* run ) {
+    pcg32_srandom_r(&run->rng, SEED, 54u);
+    run->base_rss = get_rss();
+
+    printf("%-10s %-12s %9s %12s %12s %8s %12s\n",
+           run->backend->name, "phase", "ops", "live KB", "RSS KB", "RSS/live", "largest KB");
+
+    for ( u64 slot = 0; slot < SLOTS; slot++ ) alloc_slot(run, slot, SMALL);
+    sample(run, "ramp-up", SLOTS);
+
+    for ( u64 slot = 0; slot < SLOTS; slot++ ) if ( pcg32_random_r(&run->rng) & 1 ) free_slot(run, slot);
+    sample(run, "free-random", SLOTS);
+
+    churn(run, "churn", SHIFTED);
+    churn(run, "mixed", MIXED);
+
+    for ( u64 slot = 0; slot < SLOTS; slot++ ) free_slot(run, slot);
+    sample(run, "teardown", SLOTS);
+
+    bool result = !run->corrupted;
+    if ( run->corrupted ) fprintf(stderr, "%s: a live block was overwritten\n", run->backend->name);
+
+    if ( run->backend->has_stats ) {
+        stats_t stats = { 0 };
+        get_stats(&stats);
+        if ( stats.free_bytes + stats.free_blocks * 4 * sizeof(u64) != stats.mapped_bytes ) {
+            fprintf(stderr, "%s: free blocks left uncoalesced after teardown\n", run->backend->name);
+            result = false;
+        }
+        if ( run->peak_ratio > MAX_RATIO ) {
+            fprintf(stderr, "%s: RSS/live peaked at %.2f\n", run->backend->name, run->peak_ratio);
+            result = false;
+        }
+    }
+
+    printf("%-10s peak RSS/live %.2f\n", run->backend->name, run->peak_ratio);
+    fflush(stdout);
+    return result;
+}
+
+static void churn ( run_t* run, const char* phase, Distribution distribution ) { /* steady state: live set stays about the same */
+    for ( u64 op = 1; op <= CHURN_OPS; op++ ) {
+        u64 slot = pcg32_boundedrand_r(&run->rng, SLOTS);
+        if ( run->ptrs[slot] ) free_slot(run, slot);
+        else alloc_slot(run, slot, distribution);
+        if ( op % SAMPLE_EVERY == 0 ) sample(run, phase, op);
+    }
+}
+
+static u64 draw_size ( run_t* run, Distribution distribution ) {
+    u32 roll = pcg32_boundedrand_r(&run->rng, 100);
+    switch ( distribution ) {
+        case SMALL: return 16 + pcg32_boundedrand_r(&run->rng, 512 - 16);
+        case SHIFTED: return 256 + pcg32_boundedrand_r(&run->rng, 4096 - 256);
+        case MIXED:
+            if ( roll < 95 ) return 16 + pcg32_boundedrand_r(&run->rng, 512 - 16);
+            return 4096 + pcg32_boundedrand_r(&run->rng, 65536 - 4096);
+    }
+    return 16;
+}
+
+static void alloc_slot ( run_t* run, u64 slot, Distribution distribution ) {
+    u64 size = draw_size(run, distribution);
+    u8* ptr = run->backend->alloc(size);
+    if ( !ptr ) {
+        run->corrupted = true;
+        return;
+    }
+    memset(ptr, (u8)slot, size); /* touch every page so RSS is honest */
+    run->ptrs[slot] = ptr;
+    run->sizes[slot] = size;
+    run->live_bytes += size;
+}
+
+static void free_slot ( run_t* run, u64 slot ) {
+    u8* ptr = run->ptrs[slot];
+    if ( !ptr ) return;
+    u64 size = run->sizes[slot];
+    if ( ptr[0] != (u8)slot || ptr[size - 1] != (u8)slot ) run->corrupted = true;
+    run->backend->release(ptr);
+    run->ptrs[slot] = NULL;
+    run->live_bytes -= size;
+}
+
+static void sample ( run_t* run, const char* phase, u64 ops ) {
+    u64 rss = get_rss();
+    rss = rss > run->base_rss ? rss - run->base_rss : 0;
+    double ratio = run->live_bytes ? (double)rss / run->live_bytes : 0.0;
+    if ( ratio > run->peak_ratio ) run->peak_ratio = ratio;
+
+    printf("%-10s %-12s %9llu %12llu %12llu ", run->backend->name, phase, ops, run->live_bytes >> 10, rss >> 10);
+    if ( run->live_bytes ) printf("%8.2f ", ratio);
+    else printf("%8s ", "-");
+
+    if ( run->backend->has_stats ) {
+        stats_t stats = { 0 };
+        get_stats(&stats);
+        printf("%12llu\n", stats.largest_free >> 10);
+    }
+    else printf("%12s\n", "n/a");
+}
+
+static u64 get_rss ( void ) { /* resident pages from /proc, in bytes */
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if ( !statm ) return 0;
+    unsigned long long size = 0, resident = 0;
+    if ( fscanf(statm, "%llu %llu", &size, &resident) != 2 ) resident = 0;
+    fclose(statm);
+    return resident * (u64)sysconf(_SC_PAGESIZE);
+}
+
+static void* libc_alloc ( u64 size ) {
+    return malloc(size);
+}
+
+static void libc_release ( void* ptr ) {
+    free(ptr);
+}
@@ -0,0 +1,220 @@
+#include "../include/test.h"
+#include "../include/shared_heap.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define REGION_SIZE (1 << 20)
+#define N_THREADS 8
+#define CHURN_BLOCKS 64
+#define CHURN_ROUNDS 1000000
+#define KILL_ROUNDS 50
+#define KILL_BLOCKS 4 /* what a killed process leaks */
+
+static const char parent_message[] = "written by the parent";
+static const char child_message[] = "written by the child";
+
+/* helpers */
+static int child_side ( int fd, u64 parent_offset, int pipe_fd );
+static bool test_threads ( void );
+static void* churn ( void* heap );
+static bool test_owner_death ( void );
+static void kill_side ( shared_heap_t* heap );
+
+bool test_shared_heap ( void ) {
+    puts("Testing shared heap");
+    bool result = true;
+
+    shared_heap_t* heap = shared_heap_create("test_shared_heap", REGION_SIZE);
+    if ( !heap ) {
+        fprintf(stderr, "Shared heap test failed: cannot create the region\n");
+        return false;
+    }
+
+    char* message = shared_allocate(heap, 64);
+    strcpy(message, parent_message);
+    u64 offset = shared_offset(heap, message);
+
+    int pipe_fds[2];
+    if ( pipe(pipe_fds) ) return false;
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if ( pid == 0 ) _exit( child_side(shared_heap_fd(heap), offset, pipe_fds[1]) );
+
+    u64 child_offset = 0;
+    int status = 0;
+    if ( read(pipe_fds[0], &child_offset, sizeof(child_offset)) != sizeof(child_offset) ) child_offset = 0;
+    waitpid(pid, &status, 0);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    if ( !WIFEXITED(status) || WEXITSTATUS(status) ) {
+        fprintf(stderr, "Child could not read the parent's block from its own mapping\n");
+        result = false;
+    }
+
+    char* reply = shared_pointer(heap, child_offset);
+    if ( !reply || strcmp(reply, child_message) ) {
+        fprintf(stderr, "Parent could not read the child's block\n");
+        result = false;
+    }
+
+    if ( shared_allocate(heap, 64) != message ) { /* the child freed it through its own mapping */
+        fprintf(stderr, "Block freed by the child was not reused\n");
+        result = false;
+    }
+
+    shared_deallocate(heap, message);
+    shared_deallocate(heap, reply);
+    void* everything = shared_allocate(heap, REGION_SIZE - 4096); /* coalesced back into one block */
+    if ( !everything ) {
+        fprintf(stderr, "Shared heap did not coalesce\n");
+        result = false;
+    }
+    if ( shared_allocate(heap, 4096) ) {
+        fprintf(stderr, "Full shared heap did not return NULL\n");
+        result = false;
+    }
+    shared_deallocate(heap, everything);
+
+    int fd = shared_heap_fd(heap);
+    shared_heap_detach(heap);
+    close(fd);
+
+    result = test_threads() && result;
+    result = test_owner_death() && result;
+
+    fprintf( !result ? stderr : stdout, !result ? "Shared heap test failed\n" : "Shared heap test passed\n" );
+    return result;
+}
+
+static int child_side ( int fd, u64 parent_offset, int pipe_fd ) { /* a second mapping, at another address */
+    shared_heap_t* heap = shared_heap_attach(fd);
+    if ( !heap ) return 1;
+
+    char* message = shared_pointer(heap, parent_offset);
+    if ( !message || strcmp(message, parent_message) ) return 1;
+
+    char* reply = shared_allocate(heap, 128);
+    if ( !reply ) return 1;
+    strcpy(reply, child_message);
+    shared_deallocate(heap, message);
+
+    u64 offset = shared_offset(heap, reply);
+    if ( write(pipe_fd, &offset, sizeof(offset)) != sizeof(offset) ) return 1;
+    shared_heap_detach(heap);
+    return 0;
+}
+
+static bool test_threads ( void ) { /* separately locked heaps share nothing, not even the tree sentinel */
+    bool result = true;
+    shared_heap_t* heaps[N_THREADS] = { 0 };
+    pthread_t threads[N_THREADS];
+
+    for ( u64 i = 0; i < N_THREADS; i++ ) { /* the private allocator is not thread safe, handles come first */
+        heaps[i] = shared_heap_create("test_shared_heap_threads", REGION_SIZE);
+        if ( !heaps[i] ) return false;
+    }
+    for ( u64 i = 0; i < N_THREADS; i++ ) pthread_create(&threads[i], NULL, churn, heaps[i]);
+
+    for ( u64 i = 0; i < N_THREADS; i++ ) {
+        void* failed = NULL;
+        pthread_join(threads[i], &failed);
+        if ( failed ) {
+            fprintf(stderr, "Shared heap %llu was corrupted by another thread\n", i);
+            result = false;
+        }
+
+        void* everything = shared_allocate(heaps[i], REGION_SIZE - 4096);
+        if ( !everything ) {
+            fprintf(stderr, "Shared heap %llu did not coalesce after the churn\n", i);
+            result = false;
+        }
+        shared_deallocate(heaps[i], everything);
+
+        int fd = shared_heap_fd(heaps[i]);
+        shared_heap_detach(heaps[i]);
+        close(fd);
+    }
+    return result;
+}
+
+static void* churn ( void* heap ) { /* returns non NULL when a block lost its content */
+    u8* blocks[CHURN_BLOCKS] = { 0 };
+    u64 state = (u64)heap;
+
+    for ( u64 round = 0; round < CHURN_ROUNDS; round++ ) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        u64 i = (state >> 33) % CHURN_BLOCKS;
+        u64 size = 16 + (state >> 40) % 2048;
+
+        if ( blocks[i] ) {
+            for ( u64 b = 0; b < 16; b++ ) if ( blocks[i][b] != (u8)i ) return heap;
+            shared_deallocate(heap, blocks[i]);
+            blocks[i] = NULL;
+        }
+        else if ( (blocks[i] = shared_allocate(heap, size)) ) memset(blocks[i], (u8)i, 16);
+    }
+
+    for ( u64 i = 0; i < CHURN_BLOCKS; i++ ) shared_deallocate(heap, blocks[i]);
+    return NULL;
+}
+
+static bool test_owner_death ( void ) { /* processes killed mid operation, most likely holding the lock */
+    bool result = true;
+    shared_heap_t* heap = shared_heap_create("test_shared_heap_death", REGION_SIZE);
+    if ( !heap ) return false;
+
+    char* survivor = shared_allocate(heap, 64);
+    strcpy(survivor, parent_message);
+
+    for ( u64 round = 0; round < KILL_ROUNDS; round++ ) {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if ( pid == 0 ) kill_side(heap); /* the mapping is shared with the child */
+
+        usleep(200 + round * 37 % 1000); /* lands anywhere inside split, coalesce or the tree fixes */
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    if ( strcmp(survivor, parent_message) ) {
+        fprintf(stderr, "Recovery overwrote a live block\n");
+        result = false;
+    }
+
+    void* pages[REGION_SIZE / 4096] = { 0 }; /* the dead processes leaked their blocks, not the rest */
+    u64 count = 0;
+    while ( count < REGION_SIZE / 4096 && (pages[count] = shared_allocate(heap, 4096)) ) memset(pages[count++], 0, 4096);
+    if ( count < REGION_SIZE / 4096 / 2 ) {
+        fprintf(stderr, "Only %llu pages left after the owners died\n", count);
+        result = false;
+    }
+    while ( count ) shared_deallocate(heap, pages[--count]);
+    shared_deallocate(heap, survivor);
+
+    int fd = shared_heap_fd(heap);
+    shared_heap_detach(heap);
+    close(fd);
+    return result;
+}
+
+static void kill_side ( shared_heap_t* heap ) { /* splits and coalesces until killed */
+    u8* blocks[KILL_BLOCKS] = { 0 };
+    u64 state = (u64)getpid();
+
+    while ( true ) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        u64 i = (state >> 33) % KILL_BLOCKS;
+        if ( blocks[i] ) shared_deallocate(heap, blocks[i]);
+        blocks[i] = shared_allocate(heap, 16 + (state >> 40) % 512);
+    }
+}
@@ -5,11 +5,11 @@
 
 #include <stdbool.h>
 #include <stdio.h>
-#include <time.h>
 #include <math.h>
 #include <stdlib.h>
 
 #define MAX_NODES 1000
+#define SEED 0x853c49e6748fea9bULL /* fixed, so a failing run can be replayed */
 
 static node_t* root = NULL;
 static node_t* nodes[MAX_NODES] = { 0 }; 
@@ -19,6 +19,7 @@ static pcg32_random_t my_rng = { 0 };
 static void init_rng ( void );
 static u64 get_rng64 ( void );
 static u32 get_rng32 ( void );
+static u64 get_node_size ( u64 limit );
 static void init_tester ( void );
 static void insert_nodes ( void );
 static void delete_nodes ( u64 n_nodes );
@@ -33,8 +34,23 @@ static bool red_root ( node_t* root );
 static bool red_red ( node_t* node );
 
 int main( void ) {
-    tree_test();     
-    return 0; 
+    return general_test() ? 0 : 1;
+}
+
+bool general_test ( void ) {
+    bool result = tree_test();
+    result = test_malloc() && result;
+    result = test_realloc() && result;
+    result = test_free() && result;
+    result = test_fragmentation() && result; /* before the arenas get chunks of their own */
+    result = test_arenas() && result;
+    result = test_shared_heap() && result;
+    result = test_init() && result;
+    result = test_options() && result;
+    result = test_tags() && result;
+    result = test_latency() && result;
+    fprintf( !result ? stderr : stdout, !result ? "Some tests failed\n" : "All tests passed\n" );
+    return result;
 }
 
 bool tree_test( void ) {
@@ -79,19 +95,20 @@ static bool count_blacks ( node_t* root, i64* blacks ) {
     else if ( !get_color(root->header) ) (*blacks)++;
 
     i64 left_count = 0; i64 right_count = 0;
-    bool left = count_blacks(root->left, &left_count);
-    bool right = count_blacks(root->right, &right_count);
+    bool left = count_blacks(get_left(root), &left_count);
+    bool right = count_blacks(get_right(root), &right_count);
 
     if ( !left || !right || left_count != right_count ) return false; 
 
-    (*blacks) += left ; 
+    (*blacks) += left_count;
     return true; 
 }
 
 static bool check_red_red ( node_t* root ) {
-    if ( get_color(root->header) && ( get_color(root->left->header) || get_color(root->right->header) ) ) 
+    if ( root == __sentinel ) return true;
+    if ( get_color(root->header) && ( get_color(get_left(root)->header) || get_color(get_right(root)->header) ) ) 
         return false;  
-    else if ( !check_red_red(root->left) && !check_red_red(root->right) ) return false; 
+    else if ( !check_red_red(get_left(root)) || !check_red_red(get_right(root)) ) return false; 
     return true; 
 }
 
@@ -128,7 +145,7 @@ static void insert_nodes ( void ) {
     if ( root == __sentinel || !root ) init_tester();
     puts("Inserting nodes");  
     for ( i32 i = 0; i < MAX_NODES; i++ ) {
-        u64 random_size = get_rng64() % 100;
+        u64 random_size = get_node_size(100);
         nodes[i] = malloc(sizeof(node_t) + sizeof(header_t) + random_size * sizeof(unsigned char));
         nodes[i] = init_node(nodes[i], random_size, __red, __free);
         insert(&root, nodes[i]);
@@ -143,29 +160,35 @@ static void insert_nodes ( void ) {
     }
     puts("Deleting nodes"); 
     while ( n_nodes-- ) {
-        i64 idx = get_rng64() % 1000;
-        while ( !nodes[idx] ) idx = get_rng64() % 1000;
-        delete(&root, nodes[idx]);  
+        i64 idx = get_rng64() % MAX_NODES;
+        while ( !nodes[idx] ) idx = get_rng64() % MAX_NODES;
+        delete(&root, nodes[idx]);
+        nodes[idx] = NULL; 
     }
     puts("Finished deleting nodes"); 
 }
 
 static void init_rng ( void ) {
-    pcg32_srandom_r(&my_rng, time(NULL), (intptr_t)&my_rng); 
+    pcg32_srandom_r(&my_rng, SEED, 54u);
 }
 
 static u64 get_rng64 ( void ) { /* for getting a random 64 bit integer */
-    return ldexpl(pcg32_random_r(&my_rng), -32); 
+    return ((u64)pcg32_random_r(&my_rng) << 32) | pcg32_random_r(&my_rng);
 }
 
 static u32 get_rng32 ( void ) { /* generated a 32 bit integer */
     return pcg32_random_r(&my_rng); 
 }
 
+static u64 get_node_size ( u64 limit ) { /* like the allocator's: aligned, so footers are, and big enough for the links */
+    u64 size = ALIGN(get_rng64() % limit);
+    return size < MIN_SIZE ? MIN_SIZE : size;
+}
+
 static void init_tester ( void ) { 
     if ( root ) return;
     init_rng();
-    u64 random_size = get_rng64() % 1000;
+    u64 random_size = get_node_size(1000);
     root = malloc( sizeof(node_t) + sizeof(header_t) + random_size * sizeof(unsigned char) );
     root = init_node(root, random_size, __black, __free); 
 } 